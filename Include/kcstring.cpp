@@ -1,16 +1,148 @@
 #include "kcstring.hpp"
+#include "../Kernel/memory.hpp"
+
+/* Word-at-a-time scanning:
+    (x - 0x01010101) & ~x & 0x80808080 is non-zero exactly when one of the four bytes of x is zero, and its
+    lowest set bit is in the first (lowest addressed, since we're little endian) zero byte.
+    To look for another byte value v, do the same on x ^ (v * 0x01010101), which turns bytes equal to v into 0.
+    Words are only read from aligned addresses. An aligned word never crosses a page boundary, so reading
+    a few bytes past the end of the string can't fault.
+*/
+
+namespace {
+    using AliasedWord = uint32_t __attribute__((may_alias));
+
+    const uint32_t low_bits = 0x01010101;
+    const uint32_t high_bits = 0x80808080;
+
+    inline uint32_t getZeroBytes (uint32_t word) {
+        return (word - low_bits) & ~word & high_bits;
+    }
+
+    // Index of the first byte that getZeroBytes flagged
+    inline uint32_t getFirstFlagged (uint32_t flags) {
+        return __builtin_ctz(flags) / 8;
+    }
+
+    inline bool isAligned (const void* ptr) {
+        return ((uint32_t)ptr & 3) == 0;
+    }
+}
 
 size_t KCString::getLength (const char* str, uint8_t ending_byte) {
-    size_t length = 0;
-    while (true) {
-        if (str[length] == ending_byte) {
-            break;
+    const char* ptr = str;
+    while (!isAligned(ptr)) {
+        if ((uint8_t)*ptr == ending_byte) {
+            return ptr - str;
         }
-        length++;
+        ptr++;
+    }
+
+    // For the usual NUL terminator the pattern is 0 and the xor does nothing
+    uint32_t pattern = ending_byte * low_bits;
+    const AliasedWord* word = (const AliasedWord*)ptr;
+    uint32_t flags;
+    while ((flags = getZeroBytes(*word ^ pattern)) == 0) {
+        word++;
     }
-    return length;
+    return ((const char*)word - str) + getFirstFlagged(flags);
 }
 
 size_t KCString::getLengthWithEnding (const char* str, uint8_t ending_byte) {
     return getLength(str, ending_byte) + 1;
-}
\ No newline at end of file
+}
+
+int KCString::strcmp (const char* a, const char* b) {
+    while (!isAligned(a)) {
+        if (*a != *b || *a == 0) {
+            return (int)(uint8_t)*a - (int)(uint8_t)*b;
+        }
+        a++;
+        b++;
+    }
+
+    // Words can only be compared if b ended up aligned as well
+    if (isAligned(b)) {
+        while (true) {
+            uint32_t word_a = *(const AliasedWord*)a;
+            if (word_a != *(const AliasedWord*)b || getZeroBytes(word_a) != 0) {
+                break;
+            }
+            a += 4;
+            b += 4;
+        }
+    }
+
+    while (*a == *b && *a != 0) {
+        a++;
+        b++;
+    }
+    return (int)(uint8_t)*a - (int)(uint8_t)*b;
+}
+
+char* KCString::strncpy (char* dest, const char* src, size_t count) {
+    const char* end = (const char*)KCString::memchr(src, 0, count);
+    size_t length = end ? end - src : count;
+
+    Memory::memcpy(dest, src, length);
+    Memory::memset(dest + length, 0, count - length);
+    return dest;
+}
+
+const char* KCString::strchr (const char* str, char chr) {
+    while (!isAligned(str)) {
+        if (*str == chr) {
+            return str;
+        }
+        if (*str == 0) {
+            return 0;
+        }
+        str++;
+    }
+
+    uint32_t pattern = (uint8_t)chr * low_bits;
+    const AliasedWord* word = (const AliasedWord*)str;
+    while (getZeroBytes(*word) == 0 && getZeroBytes(*word ^ pattern) == 0) {
+        word++;
+    }
+
+    // One of these bytes is either chr or the end of the string
+    str = (const char*)word;
+    while (*str != chr) {
+        if (*str == 0) {
+            return 0;
+        }
+        str++;
+    }
+    return str;
+}
+
+const void* KCString::memchr (const void* ptr, uint8_t value, size_t count) {
+    const uint8_t* bytes = (const uint8_t*)ptr;
+    while (count != 0 && !isAligned(bytes)) {
+        if (*bytes == value) {
+            return bytes;
+        }
+        bytes++;
+        count--;
+    }
+
+    uint32_t pattern = value * low_bits;
+    while (count >= 4) {
+        uint32_t flags = getZeroBytes(*(const AliasedWord*)bytes ^ pattern);
+        if (flags != 0) {
+            return bytes + getFirstFlagged(flags);
+        }
+        bytes += 4;
+        count -= 4;
+    }
+
+    while (count != 0) {
+        if (*bytes == value) {
+            return bytes;
+        }
+        bytes++;
+        count--;
+    }
+    return 0;
+}
@@ -9,7 +9,18 @@ namespace KCString {
 
     size_t getLengthWithEnding (const char* str, uint8_t ending_byte=0);
 
+    // < 0, 0 or > 0 when a sorts before, equal to or after b
+    int strcmp (const char* a, const char* b);
 
+    // Copies at most `count` bytes of src, and fills the rest of the `count` bytes of dest with 0.
+    // Like the C version, dest is not terminated if src is `count` bytes or longer.
+    char* strncpy (char* dest, const char* src, size_t count);
+
+    // Returns the first occurrence of chr in str (which may be the terminator), or null
+    const char* strchr (const char* str, char chr);
+
+    // Returns the first occurrence of value in the first `count` bytes of ptr, or null
+    const void* memchr (const void* ptr, uint8_t value, size_t count);
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,170 @@
+#include "acpi.hpp"
+#include "memory.hpp"
+#include "paging.hpp"
+
+namespace {
+    // Real mode segment of the EBDA, in the BIOS data area
+    const uint32_t ebda_segment_pointer = 0x40E;
+    const uint32_t bios_area_start = 0xE0000;
+    const uint32_t bios_area_end = 0x100000;
+
+    const ACPI::SDTHeader* rsdt = 0;
+
+    bool hasValidChecksum (const void* table, uint32_t length) {
+        uint8_t sum = 0;
+        for (uint32_t i = 0; i < length; i++) {
+            sum += ((const uint8_t*)table)[i];
+        }
+        return sum == 0;
+    }
+
+    bool hasSignature (const char* str, const char* signature, uint32_t length) {
+        for (uint32_t i = 0; i < length; i++) {
+            if (str[i] != signature[i]) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // The first MiB is always in the direct map, tables elsewhere may not be
+    const void* mapPhysical (uint32_t physical_address, uint32_t size) {
+        uint32_t end = physical_address + size;
+        if (end <= Memory::direct_map_limit && end >= physical_address &&
+            Paging::isMapped((uint32_t)Memory::physicalToVirtual(physical_address)) &&
+            Paging::isMapped((uint32_t)Memory::physicalToVirtual(end - 1))) {
+            return Memory::physicalToVirtual(physical_address);
+        }
+        return Paging::mapDevice(physical_address, size);
+    }
+
+    const ACPI::RSDP* searchRSDP (uint32_t start, uint32_t end) {
+        for (uint32_t address = start; address + sizeof(ACPI::RSDP) <= end; address += 16) {
+            const ACPI::RSDP* rsdp = (const ACPI::RSDP*)Memory::physicalToVirtual(address);
+            if (hasSignature(rsdp->signature, "RSD PTR ", 8) && hasValidChecksum(rsdp, sizeof(ACPI::RSDP))) {
+                return rsdp;
+            }
+        }
+        return 0;
+    }
+
+    const ACPI::SDTHeader* mapTable (uint32_t physical_address) {
+        const ACPI::SDTHeader* header = (const ACPI::SDTHeader*)mapPhysical(physical_address, sizeof(ACPI::SDTHeader));
+        if (!header) {
+            return 0;
+        }
+        uint32_t length = header->length;
+        header = (const ACPI::SDTHeader*)mapPhysical(physical_address, length);
+        if (!header || !hasValidChecksum(header, length)) {
+            return 0;
+        }
+        return header;
+    }
+}
+
+bool ACPI::initialise () {
+    uint32_t ebda = (uint32_t)*(const uint16_t*)Memory::physicalToVirtual(ebda_segment_pointer) << 4;
+    const RSDP* rsdp = 0;
+    if (ebda != 0 && ebda < bios_area_end) {
+        rsdp = searchRSDP(ebda, ebda + 1024);
+    }
+    if (!rsdp) {
+        rsdp = searchRSDP(bios_area_start, bios_area_end);
+    }
+    if (!rsdp) {
+        return false;
+    }
+
+    // ACPI 2+ also has an XSDT with 64-bit addresses, but every 32-bit firmware fills in the RSDT as well
+    rsdt = mapTable(rsdp->rsdt_address);
+    return rsdt != 0;
+}
+
+const ACPI::SDTHeader* ACPI::findTable (const char* signature) {
+    if (!rsdt) {
+        return 0;
+    }
+    const uint32_t* entries = (const uint32_t*)(rsdt + 1);
+    uint32_t count = (rsdt->length - sizeof(SDTHeader)) / sizeof(uint32_t);
+    for (uint32_t i = 0; i < count; i++) {
+        const SDTHeader* table = mapTable(entries[i]);
+        if (table && hasSignature(table->signature, signature, 4)) {
+            return table;
+        }
+    }
+    return 0;
+}
+
+bool ACPI::readInterruptInfo (ACPI::InterruptInfo& info) {
+    const MADT::Header* madt = (const MADT::Header*)findTable("APIC");
+    if (!madt) {
+        return false;
+    }
+
+    info.local_apic_address = madt->local_apic_address;
+    info.has_8259 = madt->flags & MADT::pcat_compatible;
+    info.cpu_count = 0;
+    info.io_apic_count = 0;
+    // ISA IRQs are identity mapped, edge triggered and active high unless overridden
+    for (uint32_t irq = 0; irq < isa_irq_count; irq++) {
+        info.isa_gsi[irq] = irq;
+        info.isa_flags[irq] = 0;
+    }
+    // Where NMIs are wired on PCs, if the MADT doesn't say
+    info.nmi_lint = 1;
+    info.nmi_flags = 0;
+
+    const uint8_t* entry = (const uint8_t*)(madt + 1);
+    const uint8_t* end = (const uint8_t*)madt + madt->header.length;
+    while (entry + sizeof(MADT::EntryHeader) <= end) {
+        const MADT::EntryHeader* header = (const MADT::EntryHeader*)entry;
+        if (header->length < sizeof(MADT::EntryHeader) || entry + header->length > end) {
+            break;
+        }
+
+        switch (header->type) {
+            case MADT::EntryTypes::localAPIC: {
+                const MADT::LocalAPIC* local = (const MADT::LocalAPIC*)entry;
+                if ((local->flags & 0x01) && info.cpu_count < max_cpus) {
+                    info.cpu_apic_ids[info.cpu_count++] = local->apic_id;
+                }
+                break;
+            }
+            case MADT::EntryTypes::ioAPIC: {
+                const MADT::IOAPIC* io = (const MADT::IOAPIC*)entry;
+                if (info.io_apic_count < max_io_apics) {
+                    info.io_apic_addresses[info.io_apic_count] = io->address;
+                    info.io_apic_gsi_bases[info.io_apic_count] = io->gsi_base;
+                    info.io_apic_count++;
+                }
+                break;
+            }
+            case MADT::EntryTypes::interruptSourceOverride: {
+                const MADT::InterruptSourceOverride* source = (const MADT::InterruptSourceOverride*)entry;
+                if (source->bus == 0 && source->source < isa_irq_count) {
+                    info.isa_gsi[source->source] = source->gsi;
+                    info.isa_flags[source->source] = source->flags;
+                }
+                break;
+            }
+            case MADT::EntryTypes::localAPICNMI: {
+                const MADT::LocalAPICNMI* nmi = (const MADT::LocalAPICNMI*)entry;
+                info.nmi_lint = nmi->lint;
+                info.nmi_flags = nmi->flags;
+                break;
+            }
+            case MADT::EntryTypes::localAPICAddressOverride: {
+                const MADT::LocalAPICAddressOverride* address = (const MADT::LocalAPICAddressOverride*)entry;
+                if ((address->address >> 32) == 0) {
+                    info.local_apic_address = (uint32_t)address->address;
+                }
+                break;
+            }
+            default:
+                break;
+        }
+        entry += header->length;
+    }
+
+    return info.io_apic_count != 0;
+}
@@ -0,0 +1,147 @@
+#ifndef INCLUDE_ACPI_H
+#define INCLUDE_ACPI_H
+
+#include "../Include/stdint.h"
+
+/* ACPI:
+    The firmware describes the machine in a tree of tables. The RSDP (Root System Description Pointer) is
+    found by its signature "RSD PTR " on a 16 byte boundary, in the first KiB of the EBDA or in
+    0xE0000-0xFFFFF. It points to the RSDT, a table whose body is a list of 32-bit physical addresses of
+    the other tables. Every table starts with an SDTHeader and its bytes sum to 0.
+
+    Only the MADT ("APIC") is read so far, for the interrupt controllers and CPUs. Its body is a list of
+    variable length entries that each start with a type and a length byte.
+*/
+namespace ACPI {
+    struct RSDP {
+        char signature[8];
+        uint8_t checksum;
+        char oem_id[6];
+        uint8_t revision;
+        uint32_t rsdt_address;
+    } __attribute__((packed));
+
+    struct SDTHeader {
+        char signature[4];
+        // Of the whole table, header included
+        uint32_t length;
+        uint8_t revision;
+        uint8_t checksum;
+        char oem_id[6];
+        char oem_table_id[8];
+        uint32_t oem_revision;
+        uint32_t creator_id;
+        uint32_t creator_revision;
+    } __attribute__((packed));
+
+    namespace MADT {
+        struct Header {
+            SDTHeader header;
+            uint32_t local_apic_address;
+            uint32_t flags;
+        } __attribute__((packed));
+
+        // flags: there are 8259s as well, which have to be masked
+        static const uint32_t pcat_compatible = 0x01;
+
+        struct EntryHeader {
+            uint8_t type;
+            uint8_t length;
+        } __attribute__((packed));
+
+        struct EntryTypes {
+            static const uint8_t localAPIC = 0;
+            static const uint8_t ioAPIC = 1;
+            static const uint8_t interruptSourceOverride = 2;
+            static const uint8_t localAPICNMI = 4;
+            static const uint8_t localAPICAddressOverride = 5;
+        };
+
+        struct LocalAPIC {
+            EntryHeader header;
+            uint8_t processor_id;
+            uint8_t apic_id;
+            // Bit 0: usable, bit 1: can be turned on
+            uint32_t flags;
+        } __attribute__((packed));
+
+        struct IOAPIC {
+            EntryHeader header;
+            uint8_t id;
+            uint8_t reserved;
+            uint32_t address;
+            // The first global system interrupt it handles
+            uint32_t gsi_base;
+        } __attribute__((packed));
+
+        // An ISA IRQ that isn't wired to the GSI of the same number, or not edge triggered active high
+        struct InterruptSourceOverride {
+            EntryHeader header;
+            uint8_t bus;
+            uint8_t source;
+            uint32_t gsi;
+            uint16_t flags;
+        } __attribute__((packed));
+
+        struct LocalAPICNMI {
+            EntryHeader header;
+            // 0xFF for all of them
+            uint8_t processor_id;
+            uint16_t flags;
+            uint8_t lint;
+        } __attribute__((packed));
+
+        struct LocalAPICAddressOverride {
+            EntryHeader header;
+            uint16_t reserved;
+            uint64_t address;
+        } __attribute__((packed));
+
+        // Flags of InterruptSourceOverride and LocalAPICNMI
+        struct InterruptFlags {
+            static const uint16_t polarityMask = 0x03;
+            static const uint16_t activeLow = 0x03;
+            static const uint16_t triggerMask = 0x0C;
+            static const uint16_t levelTriggered = 0x0C;
+        };
+    };
+
+    static const uint32_t max_cpus = 16;
+    static const uint32_t max_io_apics = 4;
+    static const uint32_t isa_irq_count = 16;
+
+    // What the MADT says, with the defaults filled in
+    struct InterruptInfo {
+        uint32_t local_apic_address;
+        bool has_8259;
+
+        uint32_t cpu_count;
+        uint8_t cpu_apic_ids[max_cpus];
+
+        uint32_t io_apic_count;
+        uint32_t io_apic_addresses[max_io_apics];
+        uint32_t io_apic_gsi_bases[max_io_apics];
+
+        // For each ISA IRQ, its GSI and InterruptFlags
+        uint32_t isa_gsi[isa_irq_count];
+        uint16_t isa_flags[isa_irq_count];
+
+        // The LINT pin of the local APICs that NMIs come in on
+        uint8_t nmi_lint;
+        uint16_t nmi_flags;
+    };
+
+    // Finds the RSDP. Doesn't need Paging::init, tables that aren't mapped yet go through Paging::mapDevice
+    bool initialise ();
+
+    /** findTable:
+     * @param signature The 4 character table signature, like "APIC"
+     * @return The table (mapped, checksum checked), or null if there is no such table
+     */
+    const SDTHeader* findTable (const char* signature);
+
+    // @return false if there is no (valid) MADT
+    bool readInterruptInfo (InterruptInfo& info);
+};
+
+#endif
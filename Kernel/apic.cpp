@@ -0,0 +1,201 @@
+#include "apic.hpp"
+#include "acpi.hpp"
+#include "paging.hpp"
+#include "general_assembly.hpp"
+#include "clock.hpp"
+
+namespace {
+    const uint32_t cpuid_apic = 1 << 9;
+    const uint32_t apic_base_msr = 0x1B;
+    const uint64_t apic_base_enable = 1 << 11;
+    const uint32_t spurious_enable = 0x100;
+    // timerDivide value for dividing the bus clock by 16
+    const uint32_t timer_divide_16 = 0x03;
+    const uint64_t timer_calibration_time = 10000000;
+
+    volatile uint32_t* local_apic = 0;
+    uint8_t nmi_pin = 0xFF;
+    uint16_t nmi_pin_flags = 0;
+    uint32_t timer_period = 0;
+
+    struct IOAPICState {
+        volatile uint32_t* registers;
+        uint32_t gsi_base;
+        uint32_t count;
+        // The low halves of the redirection entries as last written, so masking is a single write
+        uint32_t low[240];
+    };
+
+    namespace IORegisters {
+        const uint32_t select = 0x00 / 4;
+        const uint32_t window = 0x10 / 4;
+        const uint32_t version = 0x01;
+        const uint32_t redirectionTable = 0x10;
+    };
+
+    IOAPICState io_apics[ACPI::max_io_apics];
+    uint32_t io_apic_count = 0;
+
+    uint32_t readIO (const IOAPICState& io, uint32_t reg) {
+        io.registers[IORegisters::select] = reg;
+        return io.registers[IORegisters::window];
+    }
+    void writeIO (const IOAPICState& io, uint32_t reg, uint32_t value) {
+        io.registers[IORegisters::select] = reg;
+        io.registers[IORegisters::window] = value;
+    }
+
+    IOAPICState* findIOAPIC (uint32_t gsi) {
+        for (uint32_t i = 0; i < io_apic_count; i++) {
+            if (gsi >= io_apics[i].gsi_base && gsi < io_apics[i].gsi_base + io_apics[i].count) {
+                return &io_apics[i];
+            }
+        }
+        return 0;
+    }
+
+    uint32_t getLVTFlags (uint16_t interrupt_flags) {
+        uint32_t flags = 0;
+        if ((interrupt_flags & ACPI::MADT::InterruptFlags::polarityMask) == ACPI::MADT::InterruptFlags::activeLow) {
+            flags |= LocalAPIC::LVT::activeLow;
+        }
+        if ((interrupt_flags & ACPI::MADT::InterruptFlags::triggerMask) == ACPI::MADT::InterruptFlags::levelTriggered) {
+            flags |= LocalAPIC::LVT::levelTriggered;
+        }
+        return flags;
+    }
+}
+
+bool LocalAPIC::isSupported () {
+    return readCPUID(1).edx & cpuid_apic;
+}
+
+bool LocalAPIC::initialise (uint32_t physical_address, uint8_t nmi_lint, uint16_t nmi_flags) {
+    local_apic = (volatile uint32_t*)Paging::mapDevice(physical_address, 0x1000);
+    if (!local_apic) {
+        return false;
+    }
+    nmi_pin = nmi_lint;
+    nmi_pin_flags = nmi_flags;
+    initialiseCPU();
+    return true;
+}
+
+// Every CPU sees its own local APIC at the same address, so the mapping is shared
+void LocalAPIC::initialiseCPU () {
+    writeMSR(apic_base_msr, readMSR(apic_base_msr) | apic_base_enable);
+
+    // Accept every priority
+    write(Registers::taskPriority, 0);
+    write(Registers::lvtTimer, LVT::masked);
+    write(Registers::lvtLINT0, nmi_pin == 0 ? LVT::deliveryNMI | getLVTFlags(nmi_pin_flags) : LVT::masked);
+    write(Registers::lvtLINT1, nmi_pin == 1 ? LVT::deliveryNMI | getLVTFlags(nmi_pin_flags) : LVT::masked);
+    write(Registers::lvtError, LVT::masked);
+    write(Registers::spuriousInterrupt, spurious_enable | spurious_vector);
+    // Drop anything that was in service before we took over
+    write(Registers::eoi, 0);
+}
+
+uint32_t LocalAPIC::read (uint32_t reg) {
+    return local_apic[reg / 4];
+}
+void LocalAPIC::write (uint32_t reg, uint32_t value) {
+    local_apic[reg / 4] = value;
+}
+
+uint8_t LocalAPIC::getID () {
+    return read(Registers::id) >> 24;
+}
+
+void LocalAPIC::sendEOI () {
+    local_apic[Registers::eoi / 4] = 0;
+}
+
+void LocalAPIC::sendIPI (uint8_t destination, uint32_t command) {
+    write(Registers::interruptCommandHigh, (uint32_t)destination << 24);
+    // Writing the low half sends it
+    write(Registers::interruptCommandLow, command);
+    while (read(Registers::interruptCommandLow) & ICR::pending) {
+        __asm__ volatile ("pause");
+    }
+}
+
+void LocalAPIC::calibrateTimer (uint32_t frequency) {
+    write(Registers::timerDivide, timer_divide_16);
+    write(Registers::lvtTimer, LVT::masked);
+    write(Registers::timerInitialCount, 0xFFFFFFFF);
+    uint64_t start = Clock::now();
+    uint64_t elapsed;
+    while ((elapsed = Clock::now() - start) < timer_calibration_time) {
+        __asm__ volatile ("pause");
+    }
+    uint32_t counted = 0xFFFFFFFF - read(Registers::timerCurrentCount);
+    write(Registers::timerInitialCount, 0);
+
+    uint64_t per_second = divide64((uint64_t)counted * 1000000000, (uint32_t)elapsed);
+    timer_period = (uint32_t)divide64(per_second, frequency);
+    if (timer_period == 0) {
+        timer_period = 1;
+    }
+}
+
+void LocalAPIC::startTimer () {
+    write(Registers::timerDivide, timer_divide_16);
+    write(Registers::lvtTimer, LVT::timerPeriodic | timer_vector);
+    write(Registers::timerInitialCount, timer_period);
+}
+
+bool IOAPIC::add (uint32_t physical_address, uint32_t gsi_base) {
+    if (io_apic_count == ACPI::max_io_apics) {
+        return false;
+    }
+    IOAPICState& io = io_apics[io_apic_count];
+    io.registers = (volatile uint32_t*)Paging::mapDevice(physical_address, 0x20);
+    if (!io.registers) {
+        return false;
+    }
+    io.gsi_base = gsi_base;
+    // Bits 16-23 of the version register are the index of the last redirection entry
+    io.count = ((readIO(io, IORegisters::version) >> 16) & 0xFF) + 1;
+    if (io.count > sizeof(io.low) / sizeof(io.low[0])) {
+        io.count = sizeof(io.low) / sizeof(io.low[0]);
+    }
+    for (uint32_t i = 0; i < io.count; i++) {
+        io.low[i] = Redirection::masked;
+        writeIO(io, IORegisters::redirectionTable + i * 2, io.low[i]);
+    }
+    io_apic_count++;
+    return true;
+}
+
+bool IOAPIC::setRedirection (uint32_t gsi, uint8_t vector, uint8_t destination, uint32_t flags) {
+    IOAPICState* io = findIOAPIC(gsi);
+    if (!io) {
+        return false;
+    }
+    uint32_t index = gsi - io->gsi_base;
+    // Masked while it is half written
+    writeIO(*io, IORegisters::redirectionTable + index * 2, Redirection::masked);
+    writeIO(*io, IORegisters::redirectionTable + index * 2 + 1, (uint32_t)destination << 24);
+    io->low[index] = vector | flags;
+    writeIO(*io, IORegisters::redirectionTable + index * 2, io->low[index]);
+    return true;
+}
+
+void IOAPIC::mask (uint32_t gsi) {
+    IOAPICState* io = findIOAPIC(gsi);
+    if (io) {
+        uint32_t index = gsi - io->gsi_base;
+        io->low[index] |= Redirection::masked;
+        writeIO(*io, IORegisters::redirectionTable + index * 2, io->low[index]);
+    }
+}
+
+void IOAPIC::unmask (uint32_t gsi) {
+    IOAPICState* io = findIOAPIC(gsi);
+    if (io) {
+        uint32_t index = gsi - io->gsi_base;
+        io->low[index] &= ~Redirection::masked;
+        writeIO(*io, IORegisters::redirectionTable + index * 2, io->low[index]);
+    }
+}
@@ -0,0 +1,124 @@
+#ifndef INCLUDE_APIC_H
+#define INCLUDE_APIC_H
+
+#include "../Include/stdint.h"
+
+/* APIC:
+    Every CPU has a local APIC, which takes interrupts for that CPU and is where they are acknowledged: one
+    write to its EOI register, rather than one or two port writes to the 8259s. Its registers are 32 bits
+    wide, 16 byte aligned, in a 4 KiB page that is usually at 0xFEE00000.
+    The I/O APIC takes the device interrupt lines (global system interrupts, GSIs) and sends each to a local
+    APIC as a vector, as configured in its redirection table. It only has two registers, IOREGSEL selects
+    which of the internal registers IOWIN reads and writes.
+*/
+namespace LocalAPIC {
+    struct Registers {
+        static const uint32_t id = 0x020;
+        static const uint32_t version = 0x030;
+        static const uint32_t taskPriority = 0x080;
+        static const uint32_t eoi = 0x0B0;
+        static const uint32_t spuriousInterrupt = 0x0F0;
+        static const uint32_t errorStatus = 0x280;
+        static const uint32_t interruptCommandLow = 0x300;
+        static const uint32_t interruptCommandHigh = 0x310;
+        static const uint32_t lvtTimer = 0x320;
+        static const uint32_t lvtLINT0 = 0x350;
+        static const uint32_t lvtLINT1 = 0x360;
+        static const uint32_t lvtError = 0x370;
+        static const uint32_t timerInitialCount = 0x380;
+        static const uint32_t timerCurrentCount = 0x390;
+        static const uint32_t timerDivide = 0x3E0;
+    };
+
+    // Local vector table entries
+    struct LVT {
+        static const uint32_t deliveryNMI = 0x400;
+        static const uint32_t activeLow = 0x2000;
+        static const uint32_t levelTriggered = 0x8000;
+        static const uint32_t masked = 0x10000;
+        static const uint32_t timerPeriodic = 0x20000;
+    };
+
+    // Interrupt command register, low half
+    struct ICR {
+        static const uint32_t deliveryInit = 0x500;
+        static const uint32_t deliveryStartup = 0x600;
+        // Set until the IPI has been accepted
+        static const uint32_t pending = 0x1000;
+        static const uint32_t levelAssert = 0x4000;
+        static const uint32_t levelTriggered = 0x8000;
+    };
+
+    // Sent instead of a real interrupt that went away before it could be delivered, needs no EOI
+    static const uint8_t spurious_vector = 0xFF;
+    static const uint8_t timer_vector = 0xF0;
+
+    // CPUID says there is one
+    bool isSupported ();
+
+    /** initialise:
+     * Maps and enables this CPU's local APIC. LINT0 (where the 8259s are wired in virtual wire mode) is
+     * masked, since everything comes through the I/O APIC.
+     *
+     * @param physical_address Of the register page, from the MADT
+     * @param nmi_lint The LINT pin NMIs come in on (0 or 1), anything else for none
+     * @param nmi_flags ACPI::MADT::InterruptFlags of the NMI pin
+     */
+    bool initialise (uint32_t physical_address, uint8_t nmi_lint, uint16_t nmi_flags);
+    // Enables the calling CPU's local APIC the same way, for the CPUs started after initialise
+    void initialiseCPU ();
+
+    uint32_t read (uint32_t reg);
+    void write (uint32_t reg, uint32_t value);
+
+    uint8_t getID ();
+
+    // Acknowledges the interrupt being handled
+    void sendEOI ();
+
+    /** calibrateTimer:
+     * Measures how fast the local APIC timer counts, against Clock. Every CPU's timer counts at the same
+     * rate (the bus clock), so this is only done once, on the boot CPU.
+     *
+     * @param frequency How often startTimer's interrupts should come, in Hz
+     */
+    void calibrateTimer (uint32_t frequency);
+    // Starts the calling CPU's timer, periodic on timer_vector
+    void startTimer ();
+
+    /** sendIPI:
+     * Sends an inter-processor interrupt and waits until the local APIC has accepted it.
+     *
+     * @param destination Local APIC ID of the target
+     * @param command Low half of the ICR: an ICR delivery mode and flags, and the vector
+     */
+    void sendIPI (uint8_t destination, uint32_t command);
+};
+
+namespace IOAPIC {
+    struct Redirection {
+        static const uint32_t activeLow = 0x2000;
+        static const uint32_t levelTriggered = 0x8000;
+        static const uint32_t masked = 0x10000;
+    };
+
+    /** add:
+     * Maps an I/O APIC and masks all of its inputs.
+     *
+     * @param gsi_base The first GSI it handles
+     * @return false if too many have been added
+     */
+    bool add (uint32_t physical_address, uint32_t gsi_base);
+
+    /** setRedirection:
+     * Sends the GSI to the local APIC `destination` as `vector`.
+     *
+     * @param flags Combination of Redirection flags
+     * @return false if no I/O APIC handles this GSI
+     */
+    bool setRedirection (uint32_t gsi, uint8_t vector, uint8_t destination, uint32_t flags);
+    void mask (uint32_t gsi);
+    void unmask (uint32_t gsi);
+};
+
+#endif
@@ -0,0 +1,452 @@
+#include "benchmark.hpp"
+#include "general_assembly.hpp"
+#include "format.hpp"
+#include "buddy_allocator.hpp"
+#include "memory.hpp"
+#include "timer.hpp"
+#include "clock.hpp"
+#include "cpu.hpp"
+#include "thread.hpp"
+#include "isr.hpp"
+#include "descriptor_tables.hpp"
+#include "function.hpp"
+#include "delegate.hpp"
+
+namespace {
+    // xorshift32, good enough to pick sizes and slots
+    uint32_t random_state = 0x12345678;
+    uint32_t nextRandom () {
+        random_state ^= random_state << 13;
+        random_state ^= random_state >> 17;
+        random_state ^= random_state << 5;
+        return random_state;
+    }
+
+    // The loops Memory::memset used to be. The empty asm keeps the compiler from turning them into calls.
+    void bytewiseMemset (void* ptr, uint8_t v, size_t size) {
+        for (size_t i = 0; i < size; i++) {
+            *(((char*)ptr)+i) = v;
+            __asm__ volatile ("" : : : "memory");
+        }
+    }
+    void bytewiseMemcpy (void* destination, const void* source, size_t size) {
+        for (size_t i = 0; i < size; i++) {
+            ((char*)destination)[i] = ((const char*)source)[i];
+            __asm__ volatile ("" : : : "memory");
+        }
+    }
+
+    uint32_t getBytesPerKilocycle (uint64_t bytes, uint64_t cycles) {
+        uint32_t kilocycles = (uint32_t)divide64(cycles, 1000);
+        return (uint32_t)divide64(bytes, kilocycles ? kilocycles : 1);
+    }
+
+    // A context that does nothing but switch straight back, for timing switch_context alone
+    uint32_t bare_main_esp;
+    uint32_t bare_helper_esp;
+    uint8_t bare_helper_stack[1024] __attribute__((aligned(16)));
+    [[noreturn]] void bareHelper () {
+        while (true) {
+            Thread::switch_context(&bare_helper_esp, bare_main_esp);
+        }
+    }
+
+    const uint32_t yield_rounds = 100000;
+    uint32_t yielders_finished = 0;
+    void yieldLoop (void*) {
+        for (uint32_t i = 0; i < yield_rounds; i++) {
+            Thread::yield();
+        }
+        __atomic_add_fetch(&yielders_finished, 1, __ATOMIC_RELEASE);
+    }
+
+    const uint32_t scheduler_threads = 2048;
+    // How often each thread got to run, static since it is far too big for the stack
+    uint32_t scheduler_rounds[scheduler_threads];
+    bool scheduler_stop = false;
+    uint32_t scheduler_finished = 0;
+    void countingLoop (void* data) {
+        uint32_t* rounds = (uint32_t*)data;
+        while (!__atomic_load_n(&scheduler_stop, __ATOMIC_ACQUIRE)) {
+            (*rounds)++;
+            Thread::yield();
+        }
+        __atomic_add_fetch(&scheduler_finished, 1, __ATOMIC_RELEASE);
+    }
+
+    // Nothing else uses it
+    const uint8_t benchmark_vector = 0x81;
+    void emptyHandler (ISR::Registers, ISR::Interrupt, ISR::StackState) {}
+    void emptyIRQHandler (ISR::Frame*) {}
+
+    uint64_t timeSoftwareInterrupts (uint32_t iterations) {
+        uint64_t start = readTimestampCounter();
+        for (uint32_t i = 0; i < iterations; i++) {
+            __asm__ volatile ("int $0x81" : : : "memory");
+        }
+        return readTimestampCounter() - start;
+    }
+
+    struct Counter {
+        uint32_t total;
+        void add (uint32_t value) {
+            total += value;
+        }
+    };
+    Counter dispatch_counter;
+    void addToCounter (uint32_t value) {
+        dispatch_counter.total += value;
+    }
+
+    // Cycles per 1000 calls
+    template<typename F>
+    uint32_t timeCalls (const F& callable, uint32_t iterations) {
+        uint64_t start = readTimestampCounter();
+        for (uint32_t i = 0; i < iterations; i++) {
+            const F* opaque = &callable;
+            // Hides what it points at, so the call can't be resolved at compile time
+            __asm__ volatile ("" : "+r"(opaque));
+            (*opaque)(i);
+        }
+        return (uint32_t)divide64((readTimestampCounter() - start) * 1000, iterations);
+    }
+
+    uint64_t getTotalSwitches () {
+        uint64_t switches = 0;
+        for (uint32_t i = 0; i < CPU::max_cpus; i++) {
+            switches += CPU::get(i).switches;
+        }
+        return switches;
+    }
+}
+
+void Benchmark::runAll () {
+    Benchmark::buddyAllocator();
+    Benchmark::memoryPrimitives();
+    Benchmark::timerWheel();
+    Benchmark::clock();
+    Benchmark::contextSwitch();
+    Benchmark::scheduler();
+    Benchmark::interruptDispatch();
+    Benchmark::delegateDispatch();
+}
+
+void Benchmark::buddyAllocator () {
+    const uint32_t slot_count = 512;
+    const uint32_t iterations = 200000;
+    // Static, the boot stack is only 4 KiB
+    static BuddyAllocator::PhysicalAddress slots[slot_count];
+    for (uint32_t i = 0; i < slot_count; i++) {
+        slots[i] = 0;
+    }
+
+    uint32_t allocations = 0;
+    uint32_t failures = 0;
+    uint64_t start = readTimestampCounter();
+    for (uint32_t i = 0; i < iterations; i++) {
+        uint32_t random = nextRandom();
+        uint32_t slot = random % slot_count;
+        if (slots[slot] != 0) {
+            BuddyAllocator::free(slots[slot]);
+            slots[slot] = 0;
+            continue;
+        }
+
+        // Mostly small blocks, like real users: half are order 0, a quarter order 1, ...
+        uint32_t order = 0;
+        while (order < 6 && (random & (0x100 << order))) {
+            order++;
+        }
+        slots[slot] = BuddyAllocator::allocate(order);
+        if (slots[slot] == 0) {
+            failures++;
+        } else {
+            allocations++;
+        }
+    }
+    uint64_t cycles = readTimestampCounter() - start;
+
+    // Fragmentation: how much of the free memory is *not* in the largest free block.
+    uint32_t free_frames = BuddyAllocator::getFreeFrameCount();
+    uint32_t largest = 0;
+    for (uint32_t order = 0; order <= BuddyAllocator::max_order; order++) {
+        if (BuddyAllocator::getFreeBlockCount(order) != 0) {
+            largest = 1u << order;
+        }
+    }
+    uint32_t fragmentation = free_frames == 0 ? 0 : 100 - (largest * 100) / free_frames;
+
+    for (uint32_t i = 0; i < slot_count; i++) {
+        BuddyAllocator::free(slots[i]);
+    }
+
+    // In kilo units on both sides, so the divisor fits in 32 bits, 0 without a calibrated TSC
+    uint32_t kilocycles = (uint32_t)divide64(cycles, 1000);
+    uint64_t tsc_kilohertz = divide64(Clock::getTSCFrequency(), 1000);
+    kprintf(SerialPort::LOG, "buddy: allocations %u failed %u cycles/op %u allocs/s %u fragmentation %u%% pool frames %u\n",
+        allocations, failures,
+        (uint32_t)divide64(cycles, iterations),
+        (uint32_t)divide64((uint64_t)allocations * tsc_kilohertz, kilocycles ? kilocycles : 1),
+        fragmentation, BuddyAllocator::getPoolFrameCount());
+}
+
+void Benchmark::memoryPrimitives () {
+    const uint32_t max_size = 1024 * 1024;
+    // Every size moves about this many bytes in total, so small sizes are repeated more often
+    const uint32_t bytes_per_size = 4 * 1024 * 1024;
+    const uint32_t order = BuddyAllocator::getOrderForSize(max_size);
+
+    BuddyAllocator::PhysicalAddress source_block = BuddyAllocator::allocate(order);
+    BuddyAllocator::PhysicalAddress destination_block = BuddyAllocator::allocate(order);
+    if (source_block == 0 || destination_block == 0) {
+        BuddyAllocator::free(source_block);
+        BuddyAllocator::free(destination_block);
+        kprintf(SerialPort::LOG, "memory: no memory for buffers\n");
+        return;
+    }
+    uint8_t* source = (uint8_t*)Memory::physicalToVirtual(source_block);
+    uint8_t* destination = (uint8_t*)Memory::physicalToVirtual(destination_block);
+    Memory::memset(source, 0x5A, max_size);
+
+    for (uint32_t size = 1; size <= max_size; size *= 4) {
+        uint32_t repetitions = bytes_per_size / size;
+        uint64_t bytes = (uint64_t)repetitions * size;
+        uint64_t start;
+
+        // Offset by one so the head/tail handling is part of what's measured
+        uint32_t offset = size < max_size ? 1 : 0;
+
+        start = readTimestampCounter();
+        for (uint32_t i = 0; i < repetitions; i++) {
+            bytewiseMemset(destination + offset, (uint8_t)i, size);
+        }
+        uint64_t old_memset = readTimestampCounter() - start;
+
+        start = readTimestampCounter();
+        for (uint32_t i = 0; i < repetitions; i++) {
+            Memory::memset(destination + offset, (uint8_t)i, size);
+        }
+        uint64_t new_memset = readTimestampCounter() - start;
+
+        start = readTimestampCounter();
+        for (uint32_t i = 0; i < repetitions; i++) {
+            bytewiseMemcpy(destination + offset, source, size);
+        }
+        uint64_t old_memcpy = readTimestampCounter() - start;
+
+        start = readTimestampCounter();
+        for (uint32_t i = 0; i < repetitions; i++) {
+            Memory::memcpy(destination + offset, source, size);
+        }
+        uint64_t new_memcpy = readTimestampCounter() - start;
+
+        kprintf(SerialPort::LOG, "memory: size %7u bytes/kcycle memset old %7u new %7u memcpy old %7u new %7u\n",
+            size,
+            getBytesPerKilocycle(bytes, old_memset), getBytesPerKilocycle(bytes, new_memset),
+            getBytesPerKilocycle(bytes, old_memcpy), getBytesPerKilocycle(bytes, new_memcpy));
+    }
+
+    BuddyAllocator::free(source_block);
+    BuddyAllocator::free(destination_block);
+}
+
+void Benchmark::timerWheel () {
+    const uint32_t entry_count = 1024;
+    const uint32_t rounds = 100;
+    // Static, the boot stack is only 4 KiB
+    static Timer::Entry entries[entry_count];
+    static uint32_t fired;
+    fired = 0;
+    for (uint32_t i = 0; i < entry_count; i++) {
+        Timer::initEntry(entries[i], [](void*) { fired++; }, 0);
+    }
+
+    // Spread over every level of the wheel
+    uint64_t add_cycles = 0;
+    uint64_t cancel_cycles = 0;
+    for (uint32_t round = 0; round < rounds; round++) {
+        uint64_t now = Timer::getTicks();
+        uint64_t start = readTimestampCounter();
+        for (uint32_t i = 0; i < entry_count; i++) {
+            Timer::add(entries[i], now + 1 + (nextRandom() >> (nextRandom() % 32)));
+        }
+        add_cycles += readTimestampCounter() - start;
+
+        start = readTimestampCounter();
+        for (uint32_t i = 0; i < entry_count; i++) {
+            Timer::cancel(entries[i]);
+        }
+        cancel_cycles += readTimestampCounter() - start;
+    }
+
+    // Let some of them run out, then see what the interrupt cost with everything else pending
+    Timer::HandlerStats before = Timer::getHandlerStats();
+    uint64_t now = Timer::getTicks();
+    for (uint32_t i = 0; i < entry_count; i++) {
+        Timer::add(entries[i], now + 1 + nextRandom() % (entry_count / 4));
+    }
+    Timer::sleep(entry_count / 2);
+    Timer::HandlerStats after = Timer::getHandlerStats();
+    for (uint32_t i = 0; i < entry_count; i++) {
+        Timer::cancel(entries[i]);
+    }
+
+    uint32_t operations = entry_count * rounds;
+    uint32_t interrupts = (uint32_t)(after.interrupts - before.interrupts);
+    kprintf(SerialPort::LOG, "timer: cycles/add %u cycles/cancel %u irq 0 cycles avg %u max %u over %u ticks, fired %u/%u\n",
+        (uint32_t)divide64(add_cycles, operations), (uint32_t)divide64(cancel_cycles, operations),
+        interrupts == 0 ? 0 : (uint32_t)divide64(after.total_cycles - before.total_cycles, interrupts),
+        after.max_cycles, interrupts, fired, entry_count);
+}
+
+void Benchmark::clock () {
+    const uint32_t iterations = 100000;
+
+    uint64_t sum = 0;
+    uint64_t start = readTimestampCounter();
+    for (uint32_t i = 0; i < iterations; i++) {
+        sum += Clock::now();
+    }
+    uint64_t cycles = readTimestampCounter() - start;
+    // Uses sum, so the calls can't be dropped
+    __asm__ volatile ("" : : "r"((uint32_t)sum));
+
+    // Both clocks over the same second of PIT ticks
+    uint64_t ticks_start = Timer::getTicks();
+    uint64_t clock_start = Clock::now();
+    Timer::sleep(Timer::getFrequency());
+    uint64_t clock_elapsed = Clock::now() - clock_start;
+    uint64_t tick_elapsed = divide64((Timer::getTicks() - ticks_start) * 1000000000ULL, Timer::getFrequency());
+
+    kprintf(SerialPort::LOG, "clock: cycles/now %u TSC %u kHz invariant %u, 1 s of ticks is %u ns by the TSC (ticks say %u ns)\n",
+        (uint32_t)divide64(cycles, iterations), (uint32_t)divide64(Clock::getTSCFrequency(), 1000),
+        (uint32_t)Clock::hasInvariantTSC(), clock_elapsed, tick_elapsed);
+}
+
+void Benchmark::contextSwitch () {
+    const uint32_t iterations = 100000;
+
+    // Laid out the way Thread starts a new thread: edi, esi, ebx, ebp, return address
+    uint32_t* stack = (uint32_t*)(bare_helper_stack + sizeof(bare_helper_stack));
+    *--stack = 0;
+    *--stack = (uint32_t)bareHelper;
+    *--stack = 0;
+    *--stack = 0;
+    *--stack = 0;
+    *--stack = 0;
+    bare_helper_esp = (uint32_t)stack;
+
+    uint32_t flags = saveAndDisableInterrupts();
+    uint64_t start = readTimestampCounter();
+    for (uint32_t i = 0; i < iterations; i++) {
+        Thread::switch_context(&bare_main_esp, bare_helper_esp);
+    }
+    uint64_t bare_cycles = readTimestampCounter() - start;
+    restoreInterrupts(flags);
+
+    if (!Thread::current()) {
+        kprintf(SerialPort::LOG, "context switch: cycles/switch_context %u, no threads without the heap\n",
+            (uint32_t)divide64(bare_cycles, iterations * 2));
+        return;
+    }
+
+    yielders_finished = 0;
+    Thread::create(yieldLoop, 0, "yield a");
+    Thread::create(yieldLoop, 0, "yield b");
+    uint64_t switches_before = CPU::current()->switches;
+    start = readTimestampCounter();
+    while (__atomic_load_n(&yielders_finished, __ATOMIC_ACQUIRE) != 2) {
+        Thread::yield();
+    }
+    uint64_t yield_cycles = readTimestampCounter() - start;
+    uint32_t switches = (uint32_t)(CPU::current()->switches - switches_before);
+
+    kprintf(SerialPort::LOG, "context switch: cycles/switch_context %u, cycles/switch by yield %u over %u switches\n",
+        (uint32_t)divide64(bare_cycles, iterations * 2), (uint32_t)divide64(yield_cycles, switches ? switches : 1), switches);
+}
+
+void Benchmark::scheduler () {
+    if (!Thread::current()) {
+        kprintf(SerialPort::LOG, "scheduler: no threads without the heap\n");
+        return;
+    }
+
+    __atomic_store_n(&scheduler_stop, false, __ATOMIC_RELAXED);
+    __atomic_store_n(&scheduler_finished, 0, __ATOMIC_RELAXED);
+    // Stops early if memory runs out, the rest still says something
+    uint32_t count = 0;
+    while (count < scheduler_threads) {
+        scheduler_rounds[count] = 0;
+        if (!Thread::create(countingLoop, &scheduler_rounds[count], "yield loop")) {
+            break;
+        }
+        count++;
+    }
+
+    uint64_t switches_before = getTotalSwitches();
+    uint64_t start = Clock::now();
+    // Takes its turns like the others
+    Timer::sleep(Timer::getFrequency());
+    __atomic_store_n(&scheduler_stop, true, __ATOMIC_RELEASE);
+    uint64_t elapsed = Clock::now() - start;
+    uint64_t switches = getTotalSwitches() - switches_before;
+    while (__atomic_load_n(&scheduler_finished, __ATOMIC_ACQUIRE) != count) {
+        Thread::yield();
+    }
+
+    uint64_t total = 0;
+    uint32_t least = 0xFFFFFFFF;
+    uint32_t most = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        total += scheduler_rounds[i];
+        least = scheduler_rounds[i] < least ? scheduler_rounds[i] : least;
+        most = scheduler_rounds[i] > most ? scheduler_rounds[i] : most;
+    }
+    uint32_t steals = 0;
+    for (uint32_t i = 0; i < CPU::max_cpus; i++) {
+        steals += (uint32_t)CPU::get(i).steals;
+    }
+
+    kprintf(SerialPort::LOG, "scheduler: %u threads on %u CPUs, %u switches/s, runs per thread min %u avg %u max %u, %u steals so far\n",
+        count, CPU::getOnlineCount(), (uint32_t)divide64(switches * 1000000000, (uint32_t)(elapsed ? elapsed : 1)),
+        count == 0 ? 0 : least, count == 0 ? 0 : (uint32_t)divide64(total, count), most, steals);
+}
+
+void Benchmark::interruptDispatch () {
+    const uint32_t iterations = 100000;
+
+    // Through isr_common_stub, isr_handler and the Delegate table, as every vector used to be
+    IDT::setGate(benchmark_vector, (uint32_t)ISR::isr129, 0x08, 0x8E);
+    ISR::setInterruptHandler<emptyHandler>(benchmark_vector, true);
+    uint64_t common_cycles = timeSoftwareInterrupts(iterations);
+
+    IDT::setGate(benchmark_vector, ISR::irq_stub_table[benchmark_vector - ISR::first_irq_vector], 0x08, 0x8E);
+    ISR::setIRQHandler(benchmark_vector, emptyIRQHandler, true);
+    uint64_t fast_cycles = timeSoftwareInterrupts(iterations);
+
+    kprintf(SerialPort::LOG, "interrupts: cycles/int through isr_common_stub %u, through the IRQ fast path %u\n",
+        (uint32_t)divide64(common_cycles, iterations), (uint32_t)divide64(fast_cycles, iterations));
+}
+
+void Benchmark::delegateDispatch () {
+    const uint32_t iterations = 1000000;
+    using Signature = void(uint32_t);
+    Counter* counter = &dispatch_counter;
+
+    Function<Signature> function(addToCounter);
+    Delegate<Signature> pointer(addToCounter);
+    Delegate<Signature> bound = Delegate<Signature>::fromFunction<addToCounter>();
+    Delegate<Signature> method = Delegate<Signature>::fromMethod<Counter, &Counter::add>(counter);
+    Delegate<Signature> lambda = Delegate<Signature>::fromCallable([counter] (uint32_t value) {
+        counter->total += value;
+    });
+
+    uint32_t function_cycles = timeCalls(function, iterations);
+    uint32_t pointer_cycles = timeCalls(pointer, iterations);
+    uint32_t bound_cycles = timeCalls(bound, iterations);
+    uint32_t method_cycles = timeCalls(method, iterations);
+    uint32_t lambda_cycles = timeCalls(lambda, iterations);
+
+    kprintf(SerialPort::LOG, "delegates: cycles/1000 calls Function<> %u, Delegate of a function pointer %u, fromFunction %u, fromMethod %u, fromCallable %u\n",
+        function_cycles, pointer_cycles, bound_cycles, method_cycles, lambda_cycles);
+}
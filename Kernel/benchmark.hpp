@@ -0,0 +1,40 @@
+#ifndef INCLUDE_BENCHMARK_H
+#define INCLUDE_BENCHMARK_H
+
+#include "../Include/stdint.h"
+
+/* Benchmarks:
+    In-kernel measurements of the core subsystems, timed with rdtsc and reported on the log serial port.
+    kmain only runs them when built with `make BENCHMARKS=1`, which defines KERNEL_BENCHMARKS.
+*/
+namespace Benchmark {
+    void runAll ();
+
+    // Random alloc/free churn over a mix of orders, reports throughput and fragmentation afterwards
+    void buddyAllocator ();
+
+    // memset/memcpy against the old byte-at-a-time loop, in bytes per 1000 cycles, for sizes of 1 B - 1 MiB
+    void memoryPrimitives ();
+
+    // Cycles per timer wheel add/cancel with many timers pending, and what IRQ 0 costs meanwhile
+    void timerWheel ();
+
+    // Cycles per Clock::now(), and how far the TSC and PIT clocks drift apart over a second
+    void clock ();
+
+    // Cycles per bare switch_context, and per switch when two threads yield to each other
+    void contextSwitch ();
+
+    // Thousands of threads yielding in a loop for a second, spread over the CPUs by stealing: switches per
+    // second, and how evenly the CPU time was shared between the threads
+    void scheduler ();
+
+    // Cycles per `int $n` round trip to an empty handler, through isr_common_stub and through the IRQ fast path
+    void interruptDispatch ();
+
+    // Cycles per call through a Function<> and through each kind of Delegate, with the target hidden from
+    // the compiler so every call is a real indirect one
+    void delegateDispatch ();
+};
+
+#endif
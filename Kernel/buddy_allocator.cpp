@@ -0,0 +1,215 @@
+#include "buddy_allocator.hpp"
+#include "memory.hpp"
+
+namespace {
+    const uint32_t frame_size = FrameAllocator::frame_size;
+    const uint32_t managed_frames = BuddyAllocator::max_address / frame_size;
+
+    // page_state layout, only the first frame of a block ("head") has a non-zero state:
+    // | 7 | 6    | 5    | 4    | 3 2 1 0 |
+    // | 0 | Slab | Free | Head | Order   |
+    struct PageState {
+        static const uint8_t OrderMask = 0x0F;
+        static const uint8_t Head = 0x10;
+        static const uint8_t Free = 0x20;
+        static const uint8_t Slab = 0x40;
+    };
+
+    uint8_t page_state[managed_frames];
+
+    // Stored at the start of every free block
+    struct FreeBlock {
+        BuddyAllocator::PhysicalAddress next;
+        BuddyAllocator::PhysicalAddress prev;
+    };
+
+    BuddyAllocator::PhysicalAddress free_lists[BuddyAllocator::max_order + 1];
+    uint32_t free_block_counts[BuddyAllocator::max_order + 1];
+
+    uint32_t pool_frames = 0;
+    uint32_t free_frames = 0;
+
+    FreeBlock* getBlock (BuddyAllocator::PhysicalAddress address) {
+        return (FreeBlock*)Memory::physicalToVirtual(address);
+    }
+
+    void pushFree (BuddyAllocator::PhysicalAddress address, uint32_t order) {
+        FreeBlock* block = getBlock(address);
+        block->prev = 0;
+        block->next = free_lists[order];
+        if (free_lists[order] != 0) {
+            getBlock(free_lists[order])->prev = address;
+        }
+        free_lists[order] = address;
+        free_block_counts[order]++;
+
+        page_state[address / frame_size] = PageState::Head | PageState::Free | order;
+    }
+
+    void removeFree (BuddyAllocator::PhysicalAddress address, uint32_t order) {
+        FreeBlock* block = getBlock(address);
+        if (block->prev != 0) {
+            getBlock(block->prev)->next = block->next;
+        } else {
+            free_lists[order] = block->next;
+        }
+        if (block->next != 0) {
+            getBlock(block->next)->prev = block->prev;
+        }
+        free_block_counts[order]--;
+
+        page_state[address / frame_size] = 0;
+    }
+
+    // Puts a block back on the free lists, merging it with its buddy as far up as possible
+    void release (BuddyAllocator::PhysicalAddress address, uint32_t order) {
+        while (order < BuddyAllocator::max_order) {
+            BuddyAllocator::PhysicalAddress buddy = address ^ (frame_size << order);
+            if (buddy >= BuddyAllocator::max_address) {
+                break;
+            }
+            if (page_state[buddy / frame_size] != (PageState::Head | PageState::Free | order)) {
+                break;
+            }
+
+            removeFree(buddy, order);
+            page_state[address / frame_size] = 0;
+            if (buddy < address) {
+                address = buddy;
+            }
+            order++;
+        }
+        pushFree(address, order);
+    }
+
+    // Takes a new aligned run from the FrameAllocator, as large as possible but at least `order`
+    bool grow (uint32_t order) {
+        for (uint32_t o = BuddyAllocator::max_order + 1; o-- > order;) {
+            uint32_t count = 1u << o;
+            BuddyAllocator::PhysicalAddress address = FrameAllocator::allocateContiguous(count, count, BuddyAllocator::max_address);
+            if (address != 0) {
+                pool_frames += count;
+                free_frames += count;
+                release(address, o);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    uint32_t findNonEmptyOrder (uint32_t order) {
+        while (order <= BuddyAllocator::max_order && free_lists[order] == 0) {
+            order++;
+        }
+        return order;
+    }
+}
+
+BuddyAllocator::PhysicalAddress BuddyAllocator::allocate (uint32_t order) {
+    if (order > max_order) {
+        return 0;
+    }
+
+    uint32_t current = findNonEmptyOrder(order);
+    if (current > max_order) {
+        if (!grow(order)) {
+            return 0;
+        }
+        current = findNonEmptyOrder(order);
+    }
+
+    PhysicalAddress address = free_lists[current];
+    removeFree(address, current);
+
+    // Split off the upper halves until the block is the size asked for
+    while (current > order) {
+        current--;
+        pushFree(address + (frame_size << current), current);
+    }
+
+    page_state[address / frame_size] = PageState::Head | order;
+    free_frames -= 1u << order;
+    return address;
+}
+
+void BuddyAllocator::free (BuddyAllocator::PhysicalAddress address) {
+    if (address >= max_address || address % frame_size != 0) {
+        // Fail silently.
+        return;
+    }
+
+    uint8_t state = page_state[address / frame_size];
+    if ((state & (PageState::Head | PageState::Free)) != PageState::Head) {
+        // Not allocated by us, or a double free. Fail silently.
+        return;
+    }
+
+    uint32_t order = state & PageState::OrderMask;
+    free_frames += 1u << order;
+    release(address, order);
+}
+
+BuddyAllocator::PhysicalAddress BuddyAllocator::getBlockStart (BuddyAllocator::PhysicalAddress address) {
+    if (address >= max_address) {
+        return 0;
+    }
+
+    // Blocks are aligned to their size, so the head is at most 2^max_order - 1 frames back
+    uint32_t frame = address / frame_size;
+    for (uint32_t distance = 0; distance < (1u << max_order) && distance <= frame; distance++) {
+        uint8_t state = page_state[frame - distance];
+        if (state == 0) {
+            continue;
+        }
+        if (state & PageState::Free) {
+            return 0;
+        }
+        uint32_t order = state & PageState::OrderMask;
+        if (distance >= (1u << order)) {
+            // Found the head of a different, smaller block
+            return 0;
+        }
+        return (frame - distance) * frame_size;
+    }
+    return 0;
+}
+
+void BuddyAllocator::setSlab (BuddyAllocator::PhysicalAddress block, bool is_slab) {
+    uint8_t& state = page_state[block / frame_size];
+    if (is_slab) {
+        state |= PageState::Slab;
+    } else {
+        state &= ~PageState::Slab;
+    }
+}
+
+bool BuddyAllocator::isSlab (BuddyAllocator::PhysicalAddress block) {
+    return page_state[block / frame_size] & PageState::Slab;
+}
+
+uint32_t BuddyAllocator::getOrderForSize (size_t size) {
+    uint32_t frames = (size + frame_size - 1) / frame_size;
+    uint32_t order = 0;
+    while ((1u << order) < frames) {
+        order++;
+        if (order > max_order) {
+            break;
+        }
+    }
+    return order;
+}
+
+uint32_t BuddyAllocator::getPoolFrameCount () {
+    return pool_frames;
+}
+
+uint32_t BuddyAllocator::getFreeFrameCount () {
+    return free_frames;
+}
+
+uint32_t BuddyAllocator::getFreeBlockCount (uint32_t order) {
+    if (order > max_order) {
+        return 0;
+    }
+    return free_block_counts[order];
+}
@@ -0,0 +1,60 @@
+#ifndef INCLUDE_BUDDY_ALLOCATOR_H
+#define INCLUDE_BUDDY_ALLOCATOR_H
+
+#include "../Include/stdint.h"
+#include "frame_allocator.hpp"
+#include "memory.hpp"
+
+/* Buddy Allocator:
+    Physically contiguous blocks of 2^order frames (order 0 = 4 KiB up to order 10 = 4 MiB), always aligned
+    to their own size. A block of order n splits into two "buddies" of order n-1, whose addresses differ
+    only in bit (12 + n - 1), so the buddy of any block is found with a single xor.
+    Freeing a block immediately merges it with its buddy for as long as the buddy is also free.
+
+    The free lists are threaded through the free blocks themselves. Whether a buddy is free is looked up
+    in `page_state`, which has one byte per frame below max_address.
+    Memory is taken from the FrameAllocator as aligned runs, preferably whole order 10 blocks, the first
+    time a free list of the needed size runs dry. It isn't given back.
+*/
+namespace BuddyAllocator {
+    using PhysicalAddress = FrameAllocator::PhysicalAddress;
+
+    static const uint32_t max_order = 10;
+    // Only memory below this is managed, which bounds the size of the page state table.
+    // Free blocks are written to, so they have to be in the direct map.
+    static const uint32_t max_address = Memory::direct_map_limit;
+
+    /** allocate:
+     * @param order The block is 2^order frames large
+     * @return The physical address of the block, or 0 if there is no memory left
+     */
+    PhysicalAddress allocate (uint32_t order);
+
+    /** free:
+     * The order is remembered from the allocation. Freeing an address that isn't the start of an
+     * allocated block is ignored.
+     */
+    void free (PhysicalAddress address);
+
+    /** getBlockStart:
+     * Finds the allocated block that contains an address.
+     *
+     * @param address Any address inside the block
+     * @return The start of the block, or 0 if the address isn't inside an allocated block
+     */
+    PhysicalAddress getBlockStart (PhysicalAddress address);
+
+    // Marks an allocated block as holding a slab, so the heap can tell slabs apart from large allocations
+    void setSlab (PhysicalAddress block, bool is_slab);
+    bool isSlab (PhysicalAddress block);
+
+    // Smallest order whose blocks hold `size` bytes, max_order + 1 if it's too large.
+    uint32_t getOrderForSize (size_t size);
+
+    // Frames that have been taken from the FrameAllocator
+    uint32_t getPoolFrameCount ();
+    uint32_t getFreeFrameCount ();
+    uint32_t getFreeBlockCount (uint32_t order);
+};
+
+#endif
@@ -0,0 +1,112 @@
+#include "clock.hpp"
+#include "io.hpp"
+#include "timer.hpp"
+#include "general_assembly.hpp"
+
+namespace {
+    const uint32_t cpuid_tsc = 1 << 4;
+    const uint32_t cpuid_invariant_tsc = 1 << 8;
+    const uint32_t cpuid_extended_leaves = 0x80000000;
+    const uint32_t cpuid_power_management = 0x80000007;
+
+    // 10 ms
+    const uint16_t calibration_count = PIT::base_frequency / 100;
+    const uint32_t calibration_rounds = 5;
+    // Gives up on a PIT that never counts down
+    const uint32_t calibration_max_polls = 1000000;
+
+    bool has_tsc = false;
+    bool has_invariant_tsc = false;
+    uint64_t tsc_frequency = 0;
+    uint64_t tsc_base = 0;
+    uint32_t mult = 0;
+    uint32_t shift = 0;
+
+    // Cycles that pass while channel 2 counts down calibration_count, 0 if it doesn't
+    uint64_t measureCalibrationCycles () {
+        uint8_t port_b = (uint8_t)inbyte(PIT::port_b);
+        // Gate on, speaker off
+        outbyte(PIT::port_b, (port_b & ~PIT::PortB::speakerData) | PIT::PortB::gate2);
+
+        uint32_t flags = saveAndDisableInterrupts();
+        // Mode 0 pulls the output low and starts counting once the count is written, and raises it at 0
+        outbyte(PIT::command_port, PIT::Commands::channel2 | PIT::Commands::lowHigh | PIT::Commands::interruptOnTerminalCount);
+        outbyte(PIT::channel2_port, calibration_count & 0xFF);
+        outbyte(PIT::channel2_port, (calibration_count >> 8) & 0xFF);
+        uint64_t start = readTimestampCounter();
+
+        uint32_t polls = 0;
+        while (!(inbyte(PIT::port_b) & PIT::PortB::output2) && polls < calibration_max_polls) {
+            polls++;
+        }
+        uint64_t end = readTimestampCounter();
+        restoreInterrupts(flags);
+
+        outbyte(PIT::port_b, port_b);
+        return polls == calibration_max_polls ? 0 : end - start;
+    }
+
+    // Picks mult and shift for cycles of 1 / frequency_khz ms
+    void setConversion (uint32_t frequency_khz) {
+        for (shift = 32; shift > 0; shift--) {
+            uint64_t value = divide64(1000000ULL << shift, frequency_khz);
+            if (value <= 0xFFFFFFFF) {
+                mult = (uint32_t)value;
+                return;
+            }
+        }
+        mult = (uint32_t)divide64(1000000ULL, frequency_khz);
+    }
+}
+
+void Clock::initialise () {
+    has_tsc = readCPUID(1).edx & cpuid_tsc;
+    if (!has_tsc) {
+        return;
+    }
+    if (readCPUID(cpuid_extended_leaves).eax >= cpuid_power_management) {
+        has_invariant_tsc = readCPUID(cpuid_power_management).edx & cpuid_invariant_tsc;
+    }
+
+    uint64_t best = 0;
+    for (uint32_t i = 0; i < calibration_rounds; i++) {
+        uint64_t cycles = measureCalibrationCycles();
+        if (cycles != 0 && (best == 0 || cycles < best)) {
+            best = cycles;
+        }
+    }
+    if (best == 0) {
+        has_tsc = false;
+        return;
+    }
+
+    // cycles / (calibration_count / base_frequency) seconds
+    tsc_frequency = divide64(best * PIT::base_frequency, calibration_count);
+    setConversion((uint32_t)divide64(tsc_frequency, 1000));
+    tsc_base = readTimestampCounter();
+}
+
+bool Clock::hasTSC () {
+    return has_tsc;
+}
+bool Clock::hasInvariantTSC () {
+    return has_invariant_tsc;
+}
+uint64_t Clock::getTSCFrequency () {
+    return has_tsc ? tsc_frequency : 0;
+}
+
+uint64_t Clock::now () {
+    if (!has_tsc) {
+        uint32_t frequency = Timer::getFrequency();
+        return frequency == 0 ? 0 : divide64(Timer::getTicks() * 1000000000ULL, frequency);
+    }
+    return cyclesToNanoseconds(readTimestampCounter() - tsc_base);
+}
+
+uint64_t Clock::cyclesToNanoseconds (uint64_t cycles) {
+    // 64 x 32 bit multiply in two halves, the product needs up to 96 bits before the shift
+    uint64_t low = (uint64_t)(uint32_t)cycles * mult;
+    uint64_t high = (uint64_t)(uint32_t)(cycles >> 32) * mult;
+    return (low >> shift) + (high << (32 - shift));
+}
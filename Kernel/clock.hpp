@@ -0,0 +1,33 @@
+#ifndef INCLUDE_CLOCK_H
+#define INCLUDE_CLOCK_H
+
+#include "../Include/stdint.h"
+
+/* Clock:
+    Nanoseconds since boot, read from the TSC (the CPU's cycle counter) instead of counting PIT ticks.
+    initialise measures how many cycles pass while PIT channel 2 counts down 10 ms, a few times, and keeps
+    the shortest (anything that got in the way only makes a measurement longer).
+    Cycles are turned into nanoseconds with a multiply and a shift, ns = (cycles * mult) >> shift, where
+    mult/2^shift is the length of a cycle in ns, and shift is as large as it can be with mult in 32 bits.
+    The parameters are written once by initialise and only read afterwards, so now() takes no lock and
+    works in any context, including interrupt handlers.
+
+    The TSC only counts at a fixed rate on CPUs with an invariant TSC (CPUID 0x80000007, EDX bit 8). On
+    older ones it follows the clock speed, so it is still used, but hasInvariantTSC says it can't be trusted.
+    Without a TSC at all, now() falls back to the PIT tick count from Timer.
+*/
+namespace Clock {
+    // Needs nothing set up, and doesn't use PIT channel 0
+    void initialise ();
+
+    bool hasTSC ();
+    bool hasInvariantTSC ();
+    // In Hz, 0 without a TSC
+    uint64_t getTSCFrequency ();
+
+    // Nanoseconds since initialise
+    uint64_t now ();
+    uint64_t cyclesToNanoseconds (uint64_t cycles);
+};
+
+#endif
@@ -0,0 +1,247 @@
+#include "console.hpp"
+#include "format.hpp"
+#include "frame_allocator.hpp"
+#include "timer.hpp"
+#include "clock.hpp"
+#include "cpu.hpp"
+#include "irq.hpp"
+#include "spinlock.hpp"
+#include "thread.hpp"
+#include "general_assembly.hpp"
+#include "../Include/kcstring.hpp"
+
+namespace {
+    struct Command {
+        const char* name;
+        const char* help;
+        Console::CommandFunction func;
+    };
+
+    namespace Keys {
+        const char interrupt = 0x03; // Ctrl-C
+        const char backspace = 0x08;
+        const char line_feed = '\n';
+        const char carriage_return = '\r';
+        const char kill_line = 0x15; // Ctrl-U
+        const char del = 0x7F;
+    };
+
+    const char* const prompt = "> ";
+
+    SerialPort::COMPort console_com = 0;
+    Command commands[Console::max_commands];
+    size_t command_count = 0;
+
+    // One extra byte for the terminator
+    char line[Console::line_capacity + 1];
+    size_t line_length = 0;
+    // So the LF of a CRLF doesn't end a second, empty line
+    bool last_was_carriage_return = false;
+
+    void write (const char* str) {
+        SerialPort::writeString(console_com, str, KCString::getLength(str));
+    }
+
+    void erase (size_t count) {
+        for (size_t i = 0; i < count; i++) {
+            write("\b \b");
+        }
+    }
+
+    // Splits the line in place at spaces
+    size_t splitArguments (char* str, const char** argv) {
+        size_t argc = 0;
+        while (*str != '\0') {
+            while (*str == ' ') {
+                *str++ = '\0';
+            }
+            if (*str == '\0') {
+                break;
+            }
+            if (argc == Console::max_arguments) {
+                break;
+            }
+            argv[argc++] = str;
+            while (*str != ' ' && *str != '\0') {
+                str++;
+            }
+        }
+        return argc;
+    }
+
+    void runLine () {
+        line[line_length] = '\0';
+        line_length = 0;
+
+        const char* argv[Console::max_arguments];
+        size_t argc = splitArguments(line, argv);
+        if (argc == 0) {
+            return;
+        }
+        for (size_t i = 0; i < command_count; i++) {
+            if (KCString::strcmp(commands[i].name, argv[0]) == 0) {
+                commands[i].func(argc, argv);
+                return;
+            }
+        }
+        kprintf(console_com, "unknown command '%s', try help\r\n", argv[0]);
+    }
+
+    void receive (char chr) {
+        bool was_carriage_return = last_was_carriage_return;
+        last_was_carriage_return = chr == Keys::carriage_return;
+
+        switch (chr) {
+            case Keys::line_feed:
+                if (was_carriage_return) {
+                    return;
+                }
+                [[fallthrough]];
+            case Keys::carriage_return:
+                write("\r\n");
+                runLine();
+                write(prompt);
+                return;
+            case Keys::backspace:
+            case Keys::del:
+                if (line_length > 0) {
+                    line_length--;
+                    erase(1);
+                }
+                return;
+            case Keys::kill_line:
+                erase(line_length);
+                line_length = 0;
+                return;
+            case Keys::interrupt:
+                line_length = 0;
+                write("^C\r\n");
+                write(prompt);
+                return;
+            default:
+                break;
+        }
+
+        if (chr < ' ' || chr > '~' || line_length == Console::line_capacity) {
+            return;
+        }
+        line[line_length++] = chr;
+        SerialPort::writeChar(console_com, chr);
+    }
+
+    void helpCommand (size_t, const char**) {
+        for (size_t i = 0; i < command_count; i++) {
+            kprintf(console_com, "%s - %s\r\n", commands[i].name, commands[i].help);
+        }
+    }
+
+    void serialCommand (size_t, const char**) {
+        kprintf(console_com, "dropped %u lost %u\r\n", SerialPort::getDroppedCount(), SerialPort::getLostCount());
+    }
+
+    void memoryCommand (size_t, const char**) {
+        kprintf(console_com, "frames free/total %u/%u\r\n", FrameAllocator::getFreeFrameCount(), FrameAllocator::getTotalFrameCount());
+    }
+
+    void timerCommand (size_t, const char**) {
+        Timer::HandlerStats stats = Timer::getHandlerStats();
+        uint32_t average = stats.interrupts == 0 ? 0 : (uint32_t)divide64(stats.total_cycles, (uint32_t)stats.interrupts);
+        Timer::IdleStats idle = Timer::getIdleStats();
+        kprintf(console_com, "uptime %u ms, %u Hz, irq 0 cycles avg %u max %u\r\n",
+            Timer::getMilliseconds(), Timer::getFrequency(), average, stats.max_cycles);
+        kprintf(console_com, "idle halts %u tickless %u, ticks skipped %u\r\n",
+            idle.halts, idle.tickless_halts, idle.skipped_ticks);
+    }
+
+    void clockCommand (size_t, const char**) {
+        kprintf(console_com, "now %u ns, TSC %u kHz, invariant %u\r\n",
+            Clock::now(), (uint32_t)divide64(Clock::getTSCFrequency(), 1000), (uint32_t)Clock::hasInvariantTSC());
+    }
+
+    void cpusCommand (size_t, const char**) {
+        for (uint32_t i = 0; i < CPU::max_cpus; i++) {
+            const CPU::Data& cpu = CPU::get(i);
+            if (cpu.online) {
+                kprintf(console_com, "cpu %u apic %u interrupts %u deferred %u switches %u steals %u ready %u\r\n",
+                    i, (uint32_t)cpu.apic_id, cpu.interrupts, cpu.deferred_runs, cpu.switches, cpu.steals,
+                    cpu.run_queue.count);
+            }
+        }
+    }
+
+    void irqsCommand (size_t, const char**) {
+        for (uint8_t irq = 0; irq < IRQ::isa_irq_count; irq++) {
+            const IRQ::Handler* handler = IRQ::getHandlers(irq);
+            if (!handler && IRQ::getUnhandledCount(irq) == 0) {
+                continue;
+            }
+            kprintf(console_com, "irq %u vector %u unhandled %u\r\n", (uint32_t)irq, (uint32_t)IRQ::getVector(irq),
+                IRQ::getUnhandledCount(irq));
+            for (; handler; handler = handler->next) {
+                kprintf(console_com, "    %s hits %u\r\n", handler->name, handler->hits);
+            }
+        }
+    }
+
+    void locksCommand (size_t, const char**) {
+        if (!Spinlock::stats_enabled) {
+            kprintf(console_com, "lock statistics need a build with LOCK_STATS=1\r\n");
+            return;
+        }
+        for (const Spinlock::Stats* stats = Spinlock::getStats(); stats; stats = stats->next) {
+            uint64_t average = stats->acquisitions == 0 ? 0 : divide64(stats->total_hold_cycles, (uint32_t)stats->acquisitions);
+            kprintf(console_com, "%s: acquired %u contended %u cycles held avg %u max %u\r\n", stats->name,
+                stats->acquisitions, stats->contended, average, stats->max_hold_cycles);
+        }
+    }
+}
+
+void Console::initialise (SerialPort::COMPort com) {
+    console_com = com;
+    addCommand("help", "list the commands", helpCommand);
+    addCommand("serial", "bytes dropped on send and lost on receive", serialCommand);
+    addCommand("mem", "free physical frames", memoryCommand);
+    addCommand("timer", "uptime and what the timer interrupt costs", timerCommand);
+    addCommand("clock", "nanoseconds since boot and the TSC frequency", clockCommand);
+    addCommand("cpus", "the CPUs that are online", cpusCommand);
+    addCommand("irqs", "the handlers in each IRQ's chain and how often each was hit", irqsCommand);
+    addCommand("locks", "how often each lock was taken and fought over, and how long it was held", locksCommand);
+    write(prompt);
+}
+
+bool Console::addCommand (const char* name, const char* help, void (*func) (size_t argc, const char** argv)) {
+    if (command_count == Console::max_commands) {
+        return false;
+    }
+    commands[command_count].name = name;
+    commands[command_count].help = help;
+    commands[command_count].func = func;
+    command_count++;
+    return true;
+}
+
+void Console::poll () {
+    char buffer[64];
+    size_t count;
+    while ((count = SerialPort::read(console_com, buffer, sizeof(buffer))) != 0) {
+        for (size_t i = 0; i < count; i++) {
+            receive(buffer[i]);
+        }
+    }
+}
+
+void Console::run () {
+    while (true) {
+        Console::poll();
+        // Checked with interrupts off, so a byte that arrives after the check still ends the idle
+        __asm__ volatile ("cli");
+        if (SerialPort::hasReceived(console_com)) {
+            __asm__ volatile ("sti");
+        } else if (Thread::hasReady()) {
+            __asm__ volatile ("sti");
+            Thread::yield();
+        } else {
+            Timer::idle();
+        }
+    }
+}
@@ -0,0 +1,43 @@
+#ifndef INCLUDE_CONSOLE_H
+#define INCLUDE_CONSOLE_H
+
+#include "../Include/stdint.h"
+#include "function.hpp"
+#include "io.hpp"
+
+/* Console:
+    A line-edited command prompt on a serial port, so the machine can be driven headlessly from the other
+    end of com1 (a pty in bochs, `-serial stdio` or `-serial pty` in QEMU).
+    Received bytes come out of SerialPort's receive ring and are edited into a line buffer with the usual
+    terminal keys, echoing as they go:
+        Backspace/DEL removes the last character, Ctrl-U the whole line, Ctrl-C throws the line away.
+        CR, LF or CRLF ends the line. Other control bytes and bytes past line_capacity are ignored.
+    A finished line is split at spaces and the first word looked up in the command table. Nothing here runs
+    in interrupt context, so commands may take as long as they want and print as much as they want.
+*/
+namespace Console {
+    static const size_t line_capacity = 128;
+    static const size_t max_commands = 16;
+    static const size_t max_arguments = 8;
+
+    // argv[0] is the command name
+    using CommandFunction = Function<void(size_t argc, const char** argv)>;
+
+    // Registers the built-in commands and prints the first prompt
+    void initialise (SerialPort::COMPort com);
+
+    /** addCommand:
+     * @param name Must live forever, as must help
+     * @param help One line shown by the `help` command
+     * @return false if the table is full
+     */
+    bool addCommand (const char* name, const char* help, void (*func) (size_t argc, const char** argv));
+
+    // Edits in everything received so far and runs the lines that were finished. Doesn't wait.
+    void poll ();
+
+    // Polls forever, idling the CPU (see Timer::idle) while nothing has been received
+    [[noreturn]] void run ();
+};
+
+#endif
@@ -0,0 +1,25 @@
+; Switching the CPU from one kernel thread to another (see Kernel/thread.hpp)
+
+; void switch_context (uint32_t* save_esp, uint32_t esp)
+; Saves the registers the calling convention says a call preserves on the current stack, stores esp to
+; *save_esp, then loads esp and pops the same registers off the other thread's stack. The ret goes to
+; wherever that thread called switch_context from, or to its start function if it is new.
+; Everything else is either already on the stack or free to clobber, and the callers have interrupts off,
+; so eflags needs no saving either.
+global switch_context
+switch_context:
+    mov eax, [esp + 4]
+    mov edx, [esp + 8]
+
+    push ebp
+    push ebx
+    push esi
+    push edi
+    mov [eax], esp
+
+    mov esp, edx
+    pop edi
+    pop esi
+    pop ebx
+    pop ebp
+    ret
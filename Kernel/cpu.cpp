@@ -0,0 +1,46 @@
+#include "cpu.hpp"
+#include "memory.hpp"
+
+namespace {
+    CPU::Data cpus[CPU::max_cpus];
+    uint32_t online_count = 0;
+}
+
+void CPU::initialise (uint32_t index, uint8_t apic_id, uint32_t stack_top) {
+    Data& data = cpus[index];
+    Memory::memset(&data, 0, sizeof(Data));
+    data.self = &data;
+    data.index = index;
+    data.apic_id = apic_id;
+
+    data.tss.ss0 = GDT::Selectors::kernel_data;
+    data.tss.esp0 = stack_top;
+    data.tss.iomap_base = sizeof(TSS::Entry);
+
+    GDT::setGate(data.gdt, 0, 0, 0,          0,    0);    // Null segment
+    GDT::setGate(data.gdt, 1, 0, 0xFFFFFFFF, 0x9A, 0xCF); // Code segment
+    GDT::setGate(data.gdt, 2, 0, 0xFFFFFFFF, 0x92, 0xCF); // Data segment
+    GDT::setGate(data.gdt, 3, 0, 0xFFFFFFFF, 0xFA, 0xCF); // User mode code segment
+    GDT::setGate(data.gdt, 4, 0, 0xFFFFFFFF, 0xF2, 0xCF); // User mode data segment
+    GDT::setGate(data.gdt, 5, (uint32_t)&data.tss, sizeof(TSS::Entry) - 1, 0x89, 0x00); // TSS, available
+    GDT::setGate(data.gdt, 6, (uint32_t)&data, sizeof(Data) - 1, 0x92, 0x40); // Per-CPU data, byte granular
+
+    data.gdt_pointer.limit = sizeof(data.gdt) - 1;
+    data.gdt_pointer.base = (uint32_t)&data.gdt;
+    GDT::flush((uint32_t)&data.gdt_pointer);
+    TSS::load(GDT::Selectors::tss);
+    __asm__ volatile ("mov %0, %%gs" : : "r"(GDT::Selectors::per_cpu) : "memory");
+
+    Spinlock::addStats(data.run_queue.lock.stats, "run queue");
+
+    __atomic_store_n(&data.online, true, __ATOMIC_RELEASE);
+    __atomic_add_fetch(&online_count, 1, __ATOMIC_RELEASE);
+}
+
+CPU::Data& CPU::get (uint32_t index) {
+    return cpus[index];
+}
+
+uint32_t CPU::getOnlineCount () {
+    return __atomic_load_n(&online_count, __ATOMIC_ACQUIRE);
+}
@@ -0,0 +1,90 @@
+#ifndef INCLUDE_CPU_H
+#define INCLUDE_CPU_H
+
+#include "../Include/stdint.h"
+#include "acpi.hpp"
+#include "descriptor_tables.hpp"
+#include "deferred.hpp"
+#include "thread.hpp"
+
+/* CPU:
+    State that belongs to one CPU. Each CPU has its own GDT, whose per_cpu entry is a data segment based at
+    that CPU's Data, and gs is loaded with it once and never changed (the interrupt stubs leave it alone).
+    So %gs:0 is always the running CPU's Data, and current() is a single load, with no lock and no lookup
+    of the local APIC ID. Fields that only their own CPU writes need no atomics either.
+    Each GDT also has the CPU's own TSS, for the stack to take when an interrupt comes from user mode.
+*/
+namespace CPU {
+    static const uint32_t max_cpus = ACPI::max_cpus;
+
+    struct Data {
+        // Points at itself, so that current() doesn't have to know the segment base
+        Data* self;
+        uint32_t index;
+        uint8_t apic_id;
+        bool online;
+
+        // Interrupts handled on this CPU
+        uint64_t interrupts;
+
+        // Scheduling state, see Thread
+        Thread::Control* current_thread;
+        Thread::Control* idle_thread;
+        Thread::RunQueue run_queue;
+        // Ticks left of the current thread's time slice
+        uint32_t slice;
+        bool need_reschedule;
+        uint32_t preempt_disabled;
+        // The thread that was switched away from, queued again by whichever thread runs next, once its
+        // esp has been saved
+        Thread::Control* requeue;
+        // A thread that exited, freed by whichever thread runs next since the exit ran on its stack
+        Thread::Control* dead;
+        uint64_t switches;
+        uint64_t steals;
+
+        // How deep this CPU is in IRQ handler chains, and how often it has come out of them, see IRQ
+        uint32_t irq_dispatch_depth;
+        uint32_t irq_dispatch_exits;
+
+        // Queued bottom halves, see Deferred
+        Deferred::Work* deferred;
+        bool deferred_running;
+        uint64_t deferred_runs;
+
+        // Halts in Timer::idle
+        uint64_t idle_halts;
+
+        GDT::Entry gdt[GDT::entry_count];
+        GDT::Pointer gdt_pointer;
+        TSS::Entry tss;
+    };
+    // The irqN stubs count interrupts at this offset from gs, see interrupt.s
+    static_assert(__builtin_offsetof(Data, interrupts) == 12, "CPU_INTERRUPTS_OFFSET in interrupt.s is out of date");
+
+    /** initialise:
+     * Gives the calling CPU its own GDT and TSS and points gs at its Data. The boot CPU calls this for
+     * index 0 right after init_descriptor_tables, the others (see SMP) before anything else.
+     *
+     * @param stack_top The stack interrupts from user mode start on, for the TSS
+     */
+    void initialise (uint32_t index, uint8_t apic_id, uint32_t stack_top);
+
+    static inline Data* current () {
+        Data* data;
+        // volatile, so it isn't reused across a switch to another CPU
+        __asm__ volatile ("mov %%gs:0, %0" : "=r"(data));
+        return data;
+    }
+
+    static inline uint32_t getIndex () {
+        return current()->index;
+    }
+
+    // By index, whether it is online or not
+    Data& get (uint32_t index);
+    // The number of CPUs that have called initialise
+    uint32_t getOnlineCount ();
+};
+
+#endif
@@ -0,0 +1,82 @@
+#include "deferred.hpp"
+#include "cpu.hpp"
+#include "general_assembly.hpp"
+
+namespace {
+    const uint32_t eflags_interrupts = 0x200;
+
+    // With interrupts on. The list is newest first, as queue pushed it.
+    void runList (CPU::Data* cpu, Deferred::Work* list) {
+        Deferred::Work* ordered = 0;
+        while (list) {
+            Deferred::Work* next = list->next;
+            list->next = ordered;
+            ordered = list;
+            list = next;
+        }
+
+        while (ordered) {
+            Deferred::Work* work = ordered;
+            ordered = work->next;
+            Deferred::WorkFunction func = work->func;
+            void* data = work->data;
+            // From here on it can be queued again, on any CPU, which rewrites next
+            __atomic_store_n(&work->pending, 0, __ATOMIC_RELEASE);
+            func(data);
+            cpu->deferred_runs++;
+        }
+    }
+
+    // With interrupts off
+    void runQueue (CPU::Data* cpu) {
+        if (cpu->deferred_running || !__atomic_load_n(&cpu->deferred, __ATOMIC_RELAXED)) {
+            return;
+        }
+        cpu->deferred_running = true;
+        // Keeps this thread on this CPU, so cpu stays right
+        cpu->preempt_disabled++;
+        for (uint32_t round = 0; round < Deferred::restart_limit; round++) {
+            Deferred::Work* list = __atomic_exchange_n(&cpu->deferred, (Deferred::Work*)0, __ATOMIC_ACQUIRE);
+            if (!list) {
+                break;
+            }
+            __asm__ volatile ("sti" : : : "memory");
+            runList(cpu, list);
+            __asm__ volatile ("cli" : : : "memory");
+        }
+        cpu->preempt_disabled--;
+        cpu->deferred_running = false;
+    }
+}
+
+bool Deferred::queue (Deferred::Work& work) {
+    if (__atomic_exchange_n(&work.pending, 1, __ATOMIC_ACQUIRE)) {
+        return false;
+    }
+    // Called from a thread, it may have moved to another CPU by the push, it just runs there then
+    CPU::Data* cpu = CPU::current();
+    Work* head = __atomic_load_n(&cpu->deferred, __ATOMIC_RELAXED);
+    do {
+        work.next = head;
+    } while (!__atomic_compare_exchange_n(&cpu->deferred, &head, &work, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+    return true;
+}
+
+bool Deferred::hasPending () {
+    return __atomic_load_n(&CPU::current()->deferred, __ATOMIC_RELAXED) != 0;
+}
+
+void Deferred::run () {
+    uint32_t flags = saveAndDisableInterrupts();
+    runQueue(CPU::current());
+    restoreInterrupts(flags);
+}
+
+extern "C" void Deferred::run_deferred (ISR::Frame* frame) {
+    // Whatever was interrupted had interrupts off for a reason (like holding a lock), it can wait. So can
+    // an IRQ handler that was interrupted, see IRQ.
+    CPU::Data* cpu = CPU::current();
+    if ((frame->eflags & eflags_interrupts) && cpu->irq_dispatch_depth == 0) {
+        runQueue(cpu);
+    }
+}
@@ -0,0 +1,64 @@
+#ifndef INCLUDE_DEFERRED_H
+#define INCLUDE_DEFERRED_H
+
+#include "../Include/stdint.h"
+#include "isr.hpp"
+
+/* Deferred:
+    Bottom halves for interrupt handlers. A handler does only what the hardware needs right away (read the
+    data, acknowledge it) and queues a Work for the rest, which runs with interrupts enabled, so the time
+    spent with them disabled stays in the microseconds however slow the rest is (like a serial write).
+
+    Every CPU has its own queue in its CPU::Data: a singly linked list that queue pushes onto with a
+    compare and swap, and that run takes all at once with an exchange, so it needs no lock even when an
+    interrupt queues work in the middle of run. Work runs on the CPU that queued it.
+
+    The irqN stubs call run_deferred on the way out of every interrupt, after the handler (and its EOI)
+    and before preempt_if_needed. It enables interrupts and runs the queue on the interrupted thread's
+    stack, with preemption disabled. It doesn't run in an interrupt that came in while work was already
+    running on this CPU (that one carries on with it), in one that came in with interrupts disabled, or in
+    one that nested in an IRQ handler chain (see IRQ).
+    Work queued from a thread runs at the next interrupt.
+    After restart_limit rounds of newly queued work the rest is left for the next interrupt, or for the
+    idle thread, so a flood of interrupts can't keep the interrupted thread from running for long.
+
+    A Work is queued at most once at a time: queueing one that is still pending does nothing, so a handler
+    that fires again before its work ran has the one run do it all. It is no longer pending once its
+    function starts, so it can queue itself again.
+
+    Usage:
+        Deferred::Work work = {onKey, device, 0, 0};
+        ... in the interrupt handler:
+        Deferred::queue(work);
+*/
+namespace Deferred {
+    using WorkFunction = void (*) (void* data);
+
+    // Plain data so that it can be statically allocated, pending and next start as 0
+    struct Work {
+        WorkFunction func;
+        void* data;
+        uint32_t pending;
+        Work* next;
+    };
+
+    static const uint32_t restart_limit = 4;
+
+    /** queue:
+     * Queues the work on this CPU. Any context, interrupt handlers included.
+     *
+     * @return false if it was already pending
+     */
+    bool queue (Work& work);
+
+    // Whether this CPU has work queued
+    bool hasPending ();
+
+    // Runs this CPU's queue until it is empty (or restart_limit is reached). Enables interrupts.
+    void run ();
+
+    // Called by the irqN stubs after every handler, with interrupts off
+    extern "C" void run_deferred (ISR::Frame* frame);
+};
+
+#endif
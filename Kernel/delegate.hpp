@@ -0,0 +1,109 @@
+#ifndef INCLUDE_DELEGATE_H
+#define INCLUDE_DELEGATE_H
+
+#include "../Include/stdint.h"
+#include "heap.hpp"
+
+/* Delegate:
+    Like Function, but it can carry state: a function, an object with the member function to call on it, or
+    a small callable (a lambda and its captures). The state is copied into `capacity` bytes of storage
+    inside the Delegate itself, so nothing is allocated and a Delegate can be copied like any plain struct.
+    Calling one is one indirect call to an invoker made for what it holds, which has the member function or
+    the lambda inlined into it. A function given at run time (the constructor, operator=) costs a second
+    indirect call, fromFunction doesn't.
+
+    Usage:
+        Delegate<void(uint8_t)> on_key = Delegate<void(uint8_t)>::fromMethod<Keyboard, &Keyboard::press>(&keyboard);
+        Delegate<void(uint8_t)> on_key = Delegate<void(uint8_t)>::fromCallable([device] (uint8_t key) { ... });
+        on_key(scan_code);
+*/
+template<typename, size_t capacity=2 * sizeof(void*)>
+class Delegate;
+
+template<typename ReturnValue, typename... Args, size_t capacity>
+class Delegate<ReturnValue(Args...), capacity> {
+    private:
+
+    using Invoker = ReturnValue (*) (const void* storage, Args... args);
+    using Pointer = ReturnValue (*) (Args...);
+
+    Invoker invoker;
+    alignas(void*) uint8_t storage[capacity];
+
+    static ReturnValue invokePointer (const void* storage, Args... args) {
+        return (*(const Pointer*)storage)(args...);
+    }
+
+    template<Pointer func>
+    static ReturnValue invokeFunction (const void*, Args... args) {
+        return func(args...);
+    }
+
+    template<typename T, ReturnValue (T::*method) (Args...)>
+    static ReturnValue invokeMethod (const void* storage, Args... args) {
+        return ((*(T* const*)storage)->*method)(args...);
+    }
+
+    template<typename F>
+    static ReturnValue invokeCallable (const void* storage, Args... args) {
+        return (*(const F*)storage)(args...);
+    }
+
+    public:
+
+    // constexpr, so that static Delegates are constant initialised, global constructors aren't run
+    explicit constexpr Delegate () : invoker(0), storage() {}
+
+    explicit Delegate (Pointer func) {
+        *this = func;
+    }
+
+    template<Pointer func>
+    static Delegate fromFunction () {
+        Delegate delegate;
+        delegate.invoker = invokeFunction<func>;
+        return delegate;
+    }
+
+    // `object` must outlive the Delegate, only the pointer is stored
+    template<typename T, ReturnValue (T::*method) (Args...)>
+    static Delegate fromMethod (T* object) {
+        static_assert(sizeof(T*) <= capacity, "Delegate has no room for the object pointer");
+        Delegate delegate;
+        new (delegate.storage) T*(object);
+        delegate.invoker = invokeMethod<T, method>;
+        return delegate;
+    }
+
+    template<typename F>
+    static Delegate fromCallable (const F& callable) {
+        static_assert(sizeof(F) <= capacity, "Captures too big for the Delegate's storage");
+        static_assert(alignof(F) <= alignof(void*), "Captures too strictly aligned for the Delegate's storage");
+        // Delegates are copied around as plain bytes, and what they hold is never destroyed
+        static_assert(__is_trivially_copyable(F), "Captures must be trivially copyable");
+        Delegate delegate;
+        new (delegate.storage) F(callable);
+        delegate.invoker = invokeCallable<F>;
+        return delegate;
+    }
+
+    bool hasFunction () const {
+        return invoker != 0;
+    }
+
+    Delegate& operator= (Pointer func) {
+        if (func) {
+            new (storage) Pointer(func);
+            invoker = invokePointer;
+        } else {
+            invoker = 0;
+        }
+        return *this;
+    }
+
+    ReturnValue operator() (Args... args) const {
+        return invoker(storage, args...);
+    }
+};
+
+#endif
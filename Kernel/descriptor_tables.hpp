@@ -34,11 +34,64 @@ namespace GDT {
         uint32_t base;
     } __attribute__((packed));
 
+    // Offsets of the entries. Each CPU has its own GDT (see CPU) with the same layout, so the selectors
+    // mean the same everywhere, but tss and per_cpu point at that CPU's own TSS and CPU::Data.
+    struct Selectors {
+        static const uint16_t kernel_code = 0x08;
+        static const uint16_t kernel_data = 0x10;
+        static const uint16_t user_code = 0x18;
+        static const uint16_t user_data = 0x20;
+        static const uint16_t tss = 0x28;
+        static const uint16_t per_cpu = 0x30;
+    };
+    static const uint32_t entry_count = 7;
+
     void init ();
 
     void flush (uint32_t gdt_pointer);
 
     void setGate (int32_t num, uint32_t base, uint32_t limit, uint8_t access, uint8_t gran);
+    // Sets an entry of another GDT than the boot one
+    void setGate (Entry* entries, int32_t num, uint32_t base, uint32_t limit, uint8_t access, uint8_t gran);
+}
+
+namespace TSS {
+    // Only esp0 and ss0 (the stack to switch to when an interrupt comes from ring 3) are used, the rest is
+    // for hardware task switching
+    struct Entry {
+        uint32_t previous;
+        uint32_t esp0;
+        uint32_t ss0;
+        uint32_t esp1;
+        uint32_t ss1;
+        uint32_t esp2;
+        uint32_t ss2;
+        uint32_t cr3;
+        uint32_t eip;
+        uint32_t eflags;
+        uint32_t eax;
+        uint32_t ecx;
+        uint32_t edx;
+        uint32_t ebx;
+        uint32_t esp;
+        uint32_t ebp;
+        uint32_t esi;
+        uint32_t edi;
+        uint32_t es;
+        uint32_t cs;
+        uint32_t ss;
+        uint32_t ds;
+        uint32_t fs;
+        uint32_t gs;
+        uint32_t ldt;
+        uint16_t trap;
+        // Offset of the I/O permission bitmap, sizeof(Entry) for none
+        uint16_t iomap_base;
+    } __attribute__((packed));
+
+    static inline void load (uint16_t selector) {
+        __asm__ volatile ("ltr %0" : : "r"(selector));
+    }
 }
 
 
@@ -65,6 +118,8 @@ namespace IDT {
     } __attribute__((packed));
 
     void init ();
+    // Loads the IDT that init filled in, for the other CPUs
+    void load ();
 
     extern "C" void idt_flush(uint32_t);
 
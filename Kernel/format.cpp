@@ -0,0 +1,64 @@
+#include "format.hpp"
+#include "general_assembly.hpp"
+#include "../Include/kcstring.hpp"
+
+namespace {
+    void writePadding (Format::Buffer& buffer, char chr, size_t used, size_t width) {
+        for (size_t i = used; i < width; i++) {
+            buffer.append(chr);
+        }
+    }
+}
+
+void Format::writeUnsigned (Format::Buffer& buffer, uint64_t value, const Format::Segment& segment, bool negative) {
+    // Enough for 2^64 in decimal
+    char digits[20];
+    size_t count = 0;
+
+    if (segment.kind == Kind::Hex || segment.kind == Kind::UpperHex || segment.kind == Kind::Pointer) {
+        const char* alphabet = segment.kind == Kind::UpperHex ? "0123456789ABCDEF" : "0123456789abcdef";
+        do {
+            digits[count++] = alphabet[value & 0xF];
+            value >>= 4;
+        } while (value != 0);
+    } else {
+        // 64-bit division is slow (and has to go through divide64), so only use it for the upper digits
+        while (value > 0xFFFFFFFF) {
+            uint32_t remainder;
+            value = divide64(value, 10, &remainder);
+            digits[count++] = '0' + remainder;
+        }
+        uint32_t small = (uint32_t)value;
+        do {
+            digits[count++] = '0' + small % 10;
+            small /= 10;
+        } while (small != 0);
+    }
+
+    size_t used = count + (negative ? 1 : 0);
+    if (segment.zero_pad) {
+        // The sign goes before the zeros: -0042
+        if (negative) {
+            buffer.append('-');
+        }
+        writePadding(buffer, '0', used, segment.width);
+    } else {
+        writePadding(buffer, ' ', used, segment.width);
+        if (negative) {
+            buffer.append('-');
+        }
+    }
+
+    while (count != 0) {
+        buffer.append(digits[--count]);
+    }
+}
+
+void Format::writeString (Format::Buffer& buffer, const char* str, const Format::Segment& segment) {
+    if (str == 0) {
+        str = "(null)";
+    }
+    size_t length = KCString::getLength(str);
+    writePadding(buffer, ' ', length, segment.width);
+    buffer.append(str, length);
+}
@@ -0,0 +1,306 @@
+#ifndef INCLUDE_FORMAT_H
+#define INCLUDE_FORMAT_H
+
+#include "../Include/stdint.h"
+#include "io.hpp"
+
+/* Format:
+    printf-style formatting where the format string is parsed by the compiler. KFORMAT wraps a string literal
+    in a type, the format string is split into segments at compile time, and the number and types of the
+    arguments are checked against it with static_assert. At runtime each argument is written straight into
+    the output buffer by code that already knows its conversion, width and padding.
+
+    Conversions: %d (signed decimal), %u (unsigned decimal), %x/%X (hex), %p (pointer, 0x + 8 digits),
+    %s (C string), %c (character) and %% for a literal '%'.
+    Integer conversions take an optional width, padded with spaces or, if it starts with 0, zeros: %08x, %3d.
+    Output that doesn't fit into the buffer is cut off.
+
+    Usage:
+        kprintf(SerialPort::LOG, "irq %u took %u cycles\n", irq, cycles);
+        size_t length = Format::format(buffer, sizeof(buffer), KFORMAT("%02x"), value);
+*/
+
+// Wraps a string literal in a type, so its contents can be read in constant expressions
+#define KFORMAT(literal) ([]() { \
+    struct FormatString { static constexpr const char* get () { return literal; } }; \
+    return FormatString(); \
+}())
+
+// Formats into a stack buffer and writes it to the serial port with a single writeString
+#define kprintf(com, literal, ...) Format::print(com, KFORMAT(literal), ##__VA_ARGS__)
+
+namespace Format {
+    enum class Kind : uint8_t {
+        Literal,
+        Decimal,
+        Unsigned,
+        Hex,
+        UpperHex,
+        Pointer,
+        String,
+        Character,
+        Invalid,
+    };
+
+    struct Segment {
+        Kind kind;
+        uint8_t width;
+        bool zero_pad;
+        // For literals, the part of the format string to copy
+        uint16_t start;
+        uint16_t length;
+    };
+
+    struct Buffer {
+        char* data;
+        size_t capacity;
+        size_t length;
+
+        void append (char chr) {
+            if (length < capacity) {
+                data[length++] = chr;
+            }
+        }
+        void append (const char* str, size_t count) {
+            for (size_t i = 0; i < count && length < capacity; i++) {
+                data[length++] = str[i];
+            }
+        }
+    };
+
+    static const size_t print_buffer_size = 256;
+
+    // Defined in format.cpp
+    void writeUnsigned (Buffer& buffer, uint64_t value, const Segment& segment, bool negative=false);
+    void writeString (Buffer& buffer, const char* str, const Segment& segment);
+
+    namespace detail {
+        constexpr bool isDigit (char chr) {
+            return chr >= '0' && chr <= '9';
+        }
+
+        constexpr Kind getKind (char conversion) {
+            switch (conversion) {
+                case 'd': return Kind::Decimal;
+                case 'i': return Kind::Decimal;
+                case 'u': return Kind::Unsigned;
+                case 'x': return Kind::Hex;
+                case 'X': return Kind::UpperHex;
+                case 'p': return Kind::Pointer;
+                case 's': return Kind::String;
+                case 'c': return Kind::Character;
+                default: return Kind::Invalid;
+            }
+        }
+
+        // Parses the segment starting at `position`, and stores where the next one starts in `next`
+        constexpr Segment parseSegment (const char* str, size_t position, size_t& next) {
+            Segment segment = {Kind::Literal, 0, false, (uint16_t)position, 0};
+
+            if (str[position] != '%') {
+                size_t end = position;
+                while (str[end] != 0 && str[end] != '%') {
+                    end++;
+                }
+                segment.length = end - position;
+                next = end;
+                return segment;
+            }
+
+            if (str[position + 1] == '%') {
+                segment.start = position + 1;
+                segment.length = 1;
+                next = position + 2;
+                return segment;
+            }
+
+            size_t i = position + 1;
+            if (str[i] == '0') {
+                segment.zero_pad = true;
+                i++;
+            }
+            while (isDigit(str[i])) {
+                segment.width = segment.width * 10 + (str[i] - '0');
+                i++;
+            }
+            segment.kind = getKind(str[i]);
+            next = str[i] != 0 ? i + 1 : i;
+            return segment;
+        }
+
+        constexpr size_t countSegments (const char* str) {
+            size_t count = 0;
+            size_t position = 0;
+            while (str[position] != 0) {
+                size_t next = 0;
+                parseSegment(str, position, next);
+                position = next;
+                count++;
+            }
+            return count;
+        }
+
+        template<size_t N>
+        struct Table {
+            Segment segments[N ? N : 1];
+            // Segment index of every argument conversion, in order
+            size_t arguments[N ? N : 1];
+            size_t argument_count;
+            bool valid;
+        };
+
+        template<size_t N>
+        constexpr Table<N> buildTable (const char* str) {
+            Table<N> table = {};
+            table.valid = true;
+            size_t position = 0;
+            for (size_t i = 0; i < N; i++) {
+                size_t next = 0;
+                table.segments[i] = parseSegment(str, position, next);
+                position = next;
+
+                if (table.segments[i].kind == Kind::Invalid) {
+                    table.valid = false;
+                } else if (table.segments[i].kind != Kind::Literal) {
+                    table.arguments[table.argument_count++] = i;
+                }
+            }
+            return table;
+        }
+
+        template<typename FormatString>
+        struct Compiled {
+            static constexpr size_t segment_count = countSegments(FormatString::get());
+            static constexpr Table<segment_count> table = buildTable<segment_count>(FormatString::get());
+        };
+
+        template<typename T> struct Integer { static const bool value = false; static const bool is_signed = false; };
+        template<> struct Integer<char> { static const bool value = true; static const bool is_signed = true; };
+        template<> struct Integer<signed char> { static const bool value = true; static const bool is_signed = true; };
+        template<> struct Integer<unsigned char> { static const bool value = true; static const bool is_signed = false; };
+        template<> struct Integer<short> { static const bool value = true; static const bool is_signed = true; };
+        template<> struct Integer<unsigned short> { static const bool value = true; static const bool is_signed = false; };
+        template<> struct Integer<int> { static const bool value = true; static const bool is_signed = true; };
+        template<> struct Integer<unsigned int> { static const bool value = true; static const bool is_signed = false; };
+        template<> struct Integer<long> { static const bool value = true; static const bool is_signed = true; };
+        template<> struct Integer<unsigned long> { static const bool value = true; static const bool is_signed = false; };
+        template<> struct Integer<long long> { static const bool value = true; static const bool is_signed = true; };
+        template<> struct Integer<unsigned long long> { static const bool value = true; static const bool is_signed = false; };
+
+        template<typename T> struct Pointer { static const bool value = false; };
+        template<typename T> struct Pointer<T*> { static const bool value = true; };
+
+        template<typename T> struct CString { static const bool value = false; };
+        template<> struct CString<char*> { static const bool value = true; };
+        template<> struct CString<const char*> { static const bool value = true; };
+
+        template<typename T>
+        constexpr bool accepts (Kind kind) {
+            switch (kind) {
+                case Kind::Decimal:
+                case Kind::Unsigned:
+                case Kind::Hex:
+                case Kind::UpperHex:
+                case Kind::Character:
+                    return Integer<T>::value;
+                case Kind::Pointer:
+                    return Pointer<T>::value;
+                case Kind::String:
+                    return CString<T>::value;
+                default:
+                    return false;
+            }
+        }
+
+        template<size_t... I> struct IndexSequence {};
+        template<size_t N, size_t... I> struct MakeIndexSequence : MakeIndexSequence<N - 1, N - 1, I...> {};
+        template<size_t... I> struct MakeIndexSequence<0, I...> { using type = IndexSequence<I...>; };
+
+        template<typename FormatString>
+        inline void writeLiterals (Buffer& buffer, size_t from, size_t to) {
+            using C = Compiled<FormatString>;
+            for (size_t i = from; i < to; i++) {
+                buffer.append(FormatString::get() + C::table.segments[i].start, C::table.segments[i].length);
+            }
+        }
+
+        // Index of the first segment after argument I - 1
+        template<typename FormatString, size_t I>
+        constexpr size_t getLiteralsStart () {
+            if constexpr (I == 0) {
+                return 0;
+            } else {
+                return Compiled<FormatString>::table.arguments[I - 1] + 1;
+            }
+        }
+
+        template<typename FormatString, size_t I, typename T>
+        inline void writeArgument (Buffer& buffer, T value) {
+            using C = Compiled<FormatString>;
+            constexpr size_t index = C::table.arguments[I];
+            constexpr Segment segment = C::table.segments[index];
+            static_assert(accepts<T>(segment.kind), "Format: argument type doesn't match its conversion");
+
+            // The literals between the previous argument and this one
+            writeLiterals<FormatString>(buffer, getLiteralsStart<FormatString, I>(), index);
+
+            if constexpr (Pointer<T>::value) {
+                if constexpr (segment.kind == Kind::String) {
+                    writeString(buffer, value, segment);
+                } else {
+                    buffer.append("0x", 2);
+                    writeUnsigned(buffer, (uint32_t)value, {Kind::Hex, 8, true, 0, 0});
+                }
+            } else if constexpr (segment.kind == Kind::Character) {
+                for (size_t i = 1; i < segment.width; i++) {
+                    buffer.append(' ');
+                }
+                buffer.append((char)value);
+            } else if constexpr (Integer<T>::is_signed && segment.kind == Kind::Decimal) {
+                if (value < 0) {
+                    // Negated as unsigned, -INT64_MIN would overflow
+                    writeUnsigned(buffer, 0 - (uint64_t)value, segment, true);
+                } else {
+                    writeUnsigned(buffer, (uint64_t)value, segment);
+                }
+            } else if constexpr (sizeof(T) == 8) {
+                writeUnsigned(buffer, (uint64_t)value, segment);
+            } else {
+                // Through the unsigned type of the same size, so that %x of -1 is ffffffff and not 64 bits of f
+                writeUnsigned(buffer, (uint32_t)(sizeof(T) == 1 ? (uint8_t)value : sizeof(T) == 2 ? (uint16_t)value : (uint32_t)value), segment);
+            }
+        }
+
+        template<typename FormatString, typename... Args, size_t... I>
+        inline void writeAll (Buffer& buffer, IndexSequence<I...>, Args... args) {
+            (writeArgument<FormatString, I>(buffer, args), ...);
+            writeLiterals<FormatString>(buffer, getLiteralsStart<FormatString, sizeof...(Args)>(), Compiled<FormatString>::segment_count);
+        }
+    }
+
+    /** format:
+     * @param buffer Where to write the output, it is not NUL terminated
+     * @param capacity Size of the buffer
+     * @param FormatString The format, made with KFORMAT("...")
+     * @return The number of characters written
+     */
+    template<typename FormatString, typename... Args>
+    size_t format (char* buffer, size_t capacity, FormatString, Args... args) {
+        using C = detail::Compiled<FormatString>;
+        static_assert(C::table.valid, "Format: unknown conversion in format string");
+        static_assert(C::table.argument_count == sizeof...(Args), "Format: number of arguments doesn't match the format string");
+
+        Buffer output = {buffer, capacity, 0};
+        detail::writeAll<FormatString>(output, typename detail::MakeIndexSequence<sizeof...(Args)>::type(), args...);
+        return output.length;
+    }
+
+    template<typename FormatString, typename... Args>
+    void print (SerialPort::COMPort com, FormatString format_string, Args... args) {
+        char buffer[print_buffer_size];
+        size_t length = Format::format(buffer, sizeof(buffer), format_string, args...);
+        SerialPort::writeString(com, buffer, length);
+    }
+};
+
+#endif
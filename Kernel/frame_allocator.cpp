@@ -0,0 +1,290 @@
+#include "frame_allocator.hpp"
+#include "memory.hpp"
+#include "../Include/kcstring.hpp"
+
+// Defined in link.ld
+extern "C" uint8_t kernel_physical_start[];
+extern "C" uint8_t kernel_physical_end[];
+
+namespace {
+    const uint32_t bits_per_word = 32;
+    const uint32_t bitmap_words = FrameAllocator::max_frames / bits_per_word;
+    const uint32_t summary_words = bitmap_words / bits_per_word;
+
+    const uint32_t cache_capacity = 256;
+
+    // The first MiB holds the BIOS data area, VGA memory, the ROMs and the multiboot structures.
+    const uint32_t reserved_low_frames = 0x100000 / FrameAllocator::frame_size;
+
+    uint32_t bitmap[bitmap_words];
+    uint32_t summary[summary_words];
+
+    uint32_t cache[cache_capacity];
+    uint32_t cache_count = 0;
+
+    // Bitmap word where the last refill found free frames, so the next one doesn't start over at 0
+    uint32_t search_hint = 0;
+    // One past the last bitmap word that covers available RAM. Bounds every scan.
+    uint32_t bitmap_end = 0;
+
+    uint32_t free_frames = 0;
+    uint32_t total_frames = 0;
+
+    bool isUsed (uint32_t frame) {
+        return bitmap[frame / bits_per_word] & (1u << (frame % bits_per_word));
+    }
+
+    void markUsed (uint32_t frame) {
+        uint32_t word = frame / bits_per_word;
+        bitmap[word] |= 1u << (frame % bits_per_word);
+        if (bitmap[word] == 0xFFFFFFFF) {
+            summary[word / bits_per_word] &= ~(1u << (word % bits_per_word));
+        }
+    }
+
+    void markFree (uint32_t frame) {
+        uint32_t word = frame / bits_per_word;
+        bitmap[word] &= ~(1u << (frame % bits_per_word));
+        summary[word / bits_per_word] |= 1u << (word % bits_per_word);
+    }
+
+    uint32_t alignUp (uint32_t value, uint32_t alignment) {
+        return (value + alignment - 1) & ~(alignment - 1);
+    }
+
+    // Reserves [start_frame, end_frame), only counting frames that were actually free.
+    void reserveFrames (uint32_t start_frame, uint32_t end_frame) {
+        for (uint32_t frame = start_frame; frame < end_frame && frame < FrameAllocator::max_frames; frame++) {
+            if (!isUsed(frame)) {
+                markUsed(frame);
+                free_frames--;
+                total_frames--;
+            }
+        }
+    }
+
+    // Reserves the frames that [start, end) touches, in bytes
+    void reserveRange (uint32_t start, uint32_t end) {
+        reserveFrames(start / FrameAllocator::frame_size, alignUp(end, FrameAllocator::frame_size) / FrameAllocator::frame_size);
+    }
+
+    // The modules GRUB loaded, their command lines and the list of them, which can all be above 1 MiB.
+    // Like the rest of the multiboot structures, the list and the strings are read through the mapping
+    // the loader set up.
+    void reserveModules (const Multiboot::Info* info) {
+        if (!(info->flags & Multiboot::Flags::Modules) || info->mods_count == 0) {
+            return;
+        }
+        reserveRange(info->mods_address, info->mods_address + info->mods_count * sizeof(Multiboot::Module));
+        const Multiboot::Module* modules = (const Multiboot::Module*)Memory::physicalToVirtual(info->mods_address);
+        for (uint32_t i = 0; i < info->mods_count; i++) {
+            reserveRange(modules[i].mod_start, modules[i].mod_end);
+            if (modules[i].string) {
+                const char* string = (const char*)Memory::physicalToVirtual(modules[i].string);
+                reserveRange(modules[i].string, modules[i].string + KCString::getLengthWithEnding(string));
+            }
+        }
+    }
+
+    void addAvailableRegion (uint64_t base, uint64_t length) {
+        uint64_t end = base + length;
+        if (end > 0x100000000ULL) {
+            end = 0x100000000ULL;
+        }
+        if (base >= end) {
+            return;
+        }
+
+        // Only whole frames are usable
+        uint32_t start_frame = (uint32_t)((base + FrameAllocator::frame_size - 1) / FrameAllocator::frame_size);
+        uint32_t end_frame = (uint32_t)(end / FrameAllocator::frame_size);
+
+        for (uint32_t frame = start_frame; frame < end_frame; frame++) {
+            if (isUsed(frame)) {
+                markFree(frame);
+                free_frames++;
+                total_frames++;
+            }
+        }
+
+        uint32_t end_word = (end_frame + bits_per_word - 1) / bits_per_word;
+        if (end_word > bitmap_end) {
+            bitmap_end = end_word;
+        }
+    }
+
+    // Moves free frames from the bitmap into the cache, a bitmap word at a time, until it is half full.
+    void refillCache () {
+        uint32_t summary_end = (bitmap_end + bits_per_word - 1) / bits_per_word;
+        if (summary_end == 0) {
+            return;
+        }
+        uint32_t start = (search_hint / bits_per_word) % summary_end;
+
+        for (uint32_t scanned = 0; scanned < summary_end && cache_count < cache_capacity / 2;) {
+            uint32_t summary_index = (start + scanned) % summary_end;
+            if (summary[summary_index] == 0) {
+                scanned++;
+                continue;
+            }
+
+            uint32_t word = summary_index * bits_per_word + __builtin_ctz(summary[summary_index]);
+            uint32_t free_bits = ~bitmap[word];
+            while (free_bits != 0 && cache_count < cache_capacity) {
+                uint32_t frame = word * bits_per_word + __builtin_ctz(free_bits);
+                free_bits &= free_bits - 1;
+
+                markUsed(frame);
+                cache[cache_count++] = frame;
+            }
+            search_hint = word;
+        }
+    }
+
+    // Returns frames from the cache to the bitmap until only `keep` are left
+    void spillCache (uint32_t keep) {
+        while (cache_count > keep) {
+            markFree(cache[--cache_count]);
+        }
+    }
+
+    uint32_t findRun (uint32_t count, uint32_t alignment, uint32_t limit_frame) {
+        uint32_t frame = 0;
+        while (frame + count <= limit_frame) {
+            uint32_t word = frame / bits_per_word;
+
+            // Skip 1024 frames at once when there is nothing free in them
+            if (summary[word / bits_per_word] == 0) {
+                frame = alignUp((word / bits_per_word + 1) * bits_per_word * bits_per_word, alignment);
+                continue;
+            }
+            if (bitmap[word] == 0xFFFFFFFF) {
+                frame = alignUp((word + 1) * bits_per_word, alignment);
+                continue;
+            }
+
+            uint32_t run = 0;
+            while (run < count) {
+                uint32_t current = frame + run;
+                if (current % bits_per_word == 0 && count - run >= bits_per_word && bitmap[current / bits_per_word] == 0) {
+                    run += bits_per_word;
+                    continue;
+                }
+                if (isUsed(current)) {
+                    break;
+                }
+                run++;
+            }
+
+            if (run == count) {
+                return frame;
+            }
+            frame = alignUp(frame + run + 1, alignment);
+        }
+        return FrameAllocator::max_frames;
+    }
+}
+
+void FrameAllocator::init (const Multiboot::Info* info) {
+    Memory::memset(bitmap, 0xFF, sizeof(bitmap));
+    Memory::memset(summary, 0, sizeof(summary));
+    cache_count = 0;
+    search_hint = 0;
+    bitmap_end = 0;
+    free_frames = 0;
+    total_frames = 0;
+
+    if (info->flags & Multiboot::Flags::MemoryMap) {
+        uint32_t address = info->mmap_address;
+        uint32_t end = info->mmap_address + info->mmap_length;
+        while (address < end) {
+            const Multiboot::MemoryMapEntry* entry = (const Multiboot::MemoryMapEntry*)Memory::physicalToVirtual(address);
+            if (entry->type == Multiboot::memory_available) {
+                addAvailableRegion(entry->base_address, entry->length);
+            }
+            // The size field doesn't count itself
+            address += entry->size + sizeof(entry->size);
+        }
+    } else if (info->flags & Multiboot::Flags::Memory) {
+        // No map, so fall back to the single block of upper memory above 1 MiB
+        addAvailableRegion(0x100000, (uint64_t)info->mem_upper * 1024);
+    }
+
+    reserveFrames(0, reserved_low_frames);
+    reserveFrames(
+        (uint32_t)kernel_physical_start / frame_size,
+        ((uint32_t)kernel_physical_end + frame_size - 1) / frame_size
+    );
+    reserveModules(info);
+}
+
+FrameAllocator::PhysicalAddress FrameAllocator::allocate () {
+    if (cache_count == 0) {
+        refillCache();
+        if (cache_count == 0) {
+            return 0;
+        }
+    }
+    free_frames--;
+    return cache[--cache_count] * frame_size;
+}
+
+void FrameAllocator::free (FrameAllocator::PhysicalAddress address) {
+    if (address == 0) {
+        // Fail silently.
+        return;
+    }
+    if (cache_count == cache_capacity) {
+        spillCache(cache_capacity / 2);
+    }
+    cache[cache_count++] = address / frame_size;
+    free_frames++;
+}
+
+FrameAllocator::PhysicalAddress FrameAllocator::allocateContiguous (uint32_t count, uint32_t alignment, uint64_t limit) {
+    if (count == 0 || alignment == 0 || (alignment & (alignment - 1)) != 0) {
+        return 0;
+    }
+
+    uint64_t limit_frame64 = limit / frame_size;
+    uint32_t limit_frame = bitmap_end * bits_per_word;
+    if (limit_frame64 < limit_frame) {
+        limit_frame = (uint32_t)limit_frame64;
+    }
+
+    uint32_t frame = findRun(count, alignment, limit_frame);
+    if (frame == max_frames && cache_count != 0) {
+        // The frames we need might be sitting in the cache
+        spillCache(0);
+        frame = findRun(count, alignment, limit_frame);
+    }
+    if (frame == max_frames) {
+        return 0;
+    }
+
+    for (uint32_t i = 0; i < count; i++) {
+        markUsed(frame + i);
+    }
+    free_frames -= count;
+    return frame * frame_size;
+}
+
+void FrameAllocator::freeContiguous (FrameAllocator::PhysicalAddress address, uint32_t count) {
+    uint32_t frame = address / frame_size;
+    for (uint32_t i = 0; i < count; i++) {
+        markFree(frame + i);
+    }
+    free_frames += count;
+}
+
+uint32_t FrameAllocator::getFreeFrameCount () {
+    return free_frames;
+}
+
+uint64_t FrameAllocator::getMemoryEnd () {
+    return (uint64_t)bitmap_end * bits_per_word * frame_size;
+}
+
+uint32_t FrameAllocator::getTotalFrameCount () {
+    return total_frames;
+}
@@ -0,0 +1,56 @@
+#ifndef INCLUDE_FRAME_ALLOCATOR_H
+#define INCLUDE_FRAME_ALLOCATOR_H
+
+#include "../Include/stdint.h"
+#include "multiboot.hpp"
+
+/* Frame Allocator:
+    Hands out 4 KiB physical frames. Every frame in the 32-bit physical address space has one bit in `bitmap`
+    (1 = used/reserved, 0 = free). `summary` has one bit per bitmap word which is set when that word still
+    has at least one free frame, so finding free memory skips 1024 frames per summary word instead of
+    walking the whole bitmap.
+    Single frames come from a small cache of free frame numbers, which makes allocate/free O(1) in the
+    common case. The cache is refilled from (and spilled back into) the bitmap a whole word at a time.
+    Addresses returned are physical, and 0 is used to report failure (the first MiB is never handed out).
+*/
+namespace FrameAllocator {
+    using PhysicalAddress = uint32_t;
+
+    static const uint32_t frame_size = 4096;
+    // 4 GiB / 4 KiB
+    static const uint32_t max_frames = 1024 * 1024;
+
+    /** init:
+     * Marks everything as reserved, then frees the regions the bootloader reported as available RAM,
+     * except for the first MiB, the kernel image and the modules GRUB loaded (with their command lines).
+     *
+     * @param info The multiboot information structure (already converted to a usable pointer)
+     */
+    void init (const Multiboot::Info* info);
+
+    /** allocate:
+     * @return The physical address of a free frame, or 0 if there is none
+     */
+    PhysicalAddress allocate ();
+    void free (PhysicalAddress address);
+
+    /** allocateContiguous:
+     * Finds a physically contiguous run of frames, for things like DMA buffers.
+     *
+     * @param count The number of frames
+     * @param alignment Alignment of the first frame, in frames. Must be a power of two.
+     * @param limit The run must end at or below this physical address
+     * @return The physical address of the first frame, or 0 if there is no such run
+     */
+    PhysicalAddress allocateContiguous (uint32_t count, uint32_t alignment=1, uint64_t limit=0x100000000ULL);
+    void freeContiguous (PhysicalAddress address, uint32_t count);
+
+    uint32_t getFreeFrameCount ();
+    // One past the highest available frame (rounded up to 32 frames), as a physical address
+    uint64_t getMemoryEnd ();
+    // Number of frames of RAM that the bootloader reported as available, less the ones init reserved (the
+    // first MiB, the kernel image and the boot modules)
+    uint32_t getTotalFrameCount ();
+};
+
+#endif
@@ -3,4 +3,102 @@
 
 #include "../Include/stdint.h"
 
-#endif
\ No newline at end of file
+/** readTimestampCounter:
+ * @return The number of cycles since reset, as counted by the CPU (rdtsc)
+ */
+static inline uint64_t readTimestampCounter () {
+    uint32_t low;
+    uint32_t high;
+    __asm__ volatile ("rdtsc" : "=a"(low), "=d"(high));
+    return ((uint64_t)high << 32) | low;
+}
+
+/** saveAndDisableInterrupts:
+ * For short sections that the interrupt handlers mustn't run in the middle of. Nests.
+ *
+ * @return The EFLAGS from before, to give to restoreInterrupts
+ */
+static inline uint32_t saveAndDisableInterrupts () {
+    uint32_t flags;
+    __asm__ volatile ("pushf\n\tpop %0\n\tcli" : "=r"(flags) : : "memory");
+    return flags;
+}
+// Enables interrupts again, if they were enabled when saveAndDisableInterrupts was called
+static inline void restoreInterrupts (uint32_t flags) {
+    __asm__ volatile ("push %0\n\tpopf" : : "r"(flags) : "memory", "cc");
+}
+
+struct CPUIDResult {
+    uint32_t eax;
+    uint32_t ebx;
+    uint32_t ecx;
+    uint32_t edx;
+};
+
+/** readCPUID:
+ * @param leaf The information to request (eax)
+ * @param subleaf For leaves that have several pages of information (ecx)
+ */
+static inline CPUIDResult readCPUID (uint32_t leaf, uint32_t subleaf=0) {
+    CPUIDResult result;
+    __asm__ volatile ("cpuid" : "=a"(result.eax), "=b"(result.ebx), "=c"(result.ecx), "=d"(result.edx) : "a"(leaf), "c"(subleaf));
+    return result;
+}
+
+static inline uint64_t readMSR (uint32_t msr) {
+    uint32_t low;
+    uint32_t high;
+    __asm__ volatile ("rdmsr" : "=a"(low), "=d"(high) : "c"(msr));
+    return ((uint64_t)high << 32) | low;
+}
+static inline void writeMSR (uint32_t msr, uint64_t value) {
+    __asm__ volatile ("wrmsr" : : "c"(msr), "a"((uint32_t)value), "d"((uint32_t)(value >> 32)) : "memory");
+}
+
+static inline uint32_t readCR3 () {
+    uint32_t value;
+    __asm__ volatile ("mov %%cr3, %0" : "=r"(value));
+    return value;
+}
+static inline void writeCR3 (uint32_t value) {
+    __asm__ volatile ("mov %0, %%cr3" : : "r"(value) : "memory");
+}
+static inline uint32_t readCR4 () {
+    uint32_t value;
+    __asm__ volatile ("mov %%cr4, %0" : "=r"(value));
+    return value;
+}
+static inline void writeCR4 (uint32_t value) {
+    __asm__ volatile ("mov %0, %%cr4" : : "r"(value) : "memory");
+}
+
+// Drops the TLB entry for the page that contains the address
+static inline void invalidatePage (uint32_t virtual_address) {
+    __asm__ volatile ("invlpg (%0)" : : "r"(virtual_address) : "memory");
+}
+
+/** divide64:
+ * 64-bit by 32-bit division. We don't link libgcc, so plain `/` on a uint64_t has no __udivdi3 to call.
+ *
+ * @param dividend The value to divide
+ * @param divisor The value to divide by, must not be 0
+ * @param remainder If not null, receives dividend % divisor
+ * @return dividend / divisor
+ */
+static inline uint64_t divide64 (uint64_t dividend, uint32_t divisor, uint32_t* remainder=0) {
+    uint32_t high = dividend >> 32;
+    uint32_t low = dividend & 0xFFFFFFFF;
+
+    uint32_t quotient_high = high / divisor;
+    uint32_t rest = high % divisor;
+    uint32_t quotient_low;
+    // rest < divisor, so the quotient of rest:low always fits in 32 bits
+    __asm__ ("divl %4" : "=a"(quotient_low), "=d"(rest) : "a"(low), "d"(rest), "rm"(divisor));
+
+    if (remainder) {
+        *remainder = rest;
+    }
+    return ((uint64_t)quotient_high << 32) | quotient_low;
+}
+
+#endif
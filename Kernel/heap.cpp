@@ -0,0 +1,92 @@
+#include "heap.hpp"
+#include "memory.hpp"
+#include "buddy_allocator.hpp"
+#include "spinlock.hpp"
+
+namespace {
+    Slab::Cache size_classes[Heap::class_count];
+
+    const char* class_names[Heap::class_count] = {
+        "kmalloc-16", "kmalloc-32", "kmalloc-64", "kmalloc-128",
+        "kmalloc-256", "kmalloc-512", "kmalloc-1024", "kmalloc-2048"
+    };
+
+    uint32_t getSizeClass (size_t size) {
+        if (size <= Heap::min_class_size) {
+            return 0;
+        }
+        // Index of the smallest power of two >= size, relative to 16 (2^4)
+        return 32 - __builtin_clz(size - 1) - 4;
+    }
+
+    // The slab caches and the buddy allocator under them aren't safe to use from two CPUs at once, nor
+    // from an interrupt handler in the middle of a call. Every CPU allocates threads from here, so it is
+    // the most fought over lock there is.
+    Spinlock::MCS heap_lock;
+
+    void* allocate (size_t size) {
+        if (size <= Heap::max_class_size) {
+            return Slab::allocate(size_classes[getSizeClass(size)]);
+        }
+
+        uint32_t order = BuddyAllocator::getOrderForSize(size);
+        if (order > BuddyAllocator::max_order) {
+            return 0;
+        }
+        BuddyAllocator::PhysicalAddress address = BuddyAllocator::allocate(order);
+        if (address == 0) {
+            return 0;
+        }
+        return Memory::physicalToVirtual(address);
+    }
+}
+
+void Heap::init () {
+    for (uint32_t i = 0; i < class_count; i++) {
+        Slab::initCache(size_classes[i], class_names[i], min_class_size << i);
+    }
+    Spinlock::addStats(heap_lock.stats, "heap");
+}
+
+void* kmalloc (size_t size) {
+    Spinlock::MCSNode node;
+    uint32_t flags = Spinlock::lockIRQSave(heap_lock, node);
+    void* ptr = allocate(size);
+    Spinlock::unlockIRQRestore(heap_lock, node, flags);
+    return ptr;
+}
+
+void kfree (void* ptr) {
+    if (ptr == 0) {
+        return;
+    }
+
+    Spinlock::MCSNode node;
+    uint32_t flags = Spinlock::lockIRQSave(heap_lock, node);
+    Slab::Cache* cache = Slab::getCache(ptr);
+    if (cache != 0) {
+        Slab::free(*cache, ptr);
+    } else {
+        BuddyAllocator::free(Memory::virtualToPhysical(ptr));
+    }
+    Spinlock::unlockIRQRestore(heap_lock, node, flags);
+}
+
+void* operator new (size_t size) {
+    return kmalloc(size);
+}
+void* operator new[] (size_t size) {
+    return kmalloc(size);
+}
+void operator delete (void* ptr) noexcept {
+    kfree(ptr);
+}
+void operator delete[] (void* ptr) noexcept {
+    kfree(ptr);
+}
+void operator delete (void* ptr, size_t) noexcept {
+    kfree(ptr);
+}
+void operator delete[] (void* ptr, size_t) noexcept {
+    kfree(ptr);
+}
@@ -0,0 +1,36 @@
+#ifndef INCLUDE_HEAP_H
+#define INCLUDE_HEAP_H
+
+#include "../Include/stdint.h"
+#include "slab.hpp"
+
+/* Heap:
+    kmalloc serves requests of up to 2 KiB from one slab cache per power-of-two size class (16 B - 2 KiB),
+    anything larger gets its own buddy block. kfree finds out which of the two it was from the buddy
+    allocator's page state. The global operator new/delete are routed here.
+    Subsystems with many objects of one type should make their own Slab::Cache instead.
+    kmalloc and kfree take a lock with interrupts off, so they can be used from any CPU and from interrupt
+    handlers. Slab and BuddyAllocator themselves have no lock.
+*/
+namespace Heap {
+    static const uint32_t min_class_size = 16;
+    static const uint32_t max_class_size = 2048;
+    static const uint32_t class_count = 8;
+
+    // Must be called after the FrameAllocator is initialised
+    void init ();
+};
+
+/** kmalloc:
+ * @param size Number of bytes
+ * @return The allocated memory, or null if there is none left
+ */
+void* kmalloc (size_t size);
+void kfree (void* ptr);
+
+// Placement new, normally from <new>
+inline void* operator new (size_t, void* place) noexcept {
+    return place;
+}
+
+#endif
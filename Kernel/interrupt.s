@@ -1,8 +1,11 @@
+; Every IDT entry is an interrupt gate, which clears IF on the way in, and iret restores it on the way
+; out, so the stubs have no cli or sti.
+; DF isn't cleared on the way in, and the interrupted code may have it set (Memory::memmove copies
+; backwards with it), so every stub clears it before any C++ runs. iret restores it with EFLAGS.
 ; Takes one parameter
 %macro ISR_NOERRCODE 1
     global isr%1
     isr%1:
-        cli ; disable interrupts
         push byte 0 ; dummy error code
         push %1 ; interrupt number
         jmp isr_common_stub
@@ -11,7 +14,6 @@
 %macro ISR_ERRCODE 1
     global isr%1
     isr%1:
-        cli ; disable interrupts
         push %1 ; interrupt number
         jmp isr_common_stub
 %endmacro
@@ -274,9 +276,14 @@ ISR_NOERRCODE 254
 ISR_NOERRCODE 255
 
 extern isr_handler
+extern preempt_if_needed
+extern run_deferred
+
+CPU_INTERRUPTS_OFFSET equ 12    ; of CPU::Data::interrupts, checked in Kernel/cpu.hpp
 ; Common isr function. Saves processor state, sets up for kernel mode segments.
 ; Calls the C-level interrupt handler, and then restores the stack frame
 isr_common_stub:
+    cld           ; The C++ ABI wants DF clear
     pusha         ; Pushes edi,esi,ebp,esp,ebx,edx,ecx,eax
 
     mov ax, ds    ; Set lower 16-bits of eax = ds
@@ -285,20 +292,526 @@ isr_common_stub:
     mov ax, 0x10  ; load the kernel data segment descriptor (16, so [2])
     mov ds, ax
     mov es, ax
-    mov fs, ax
-    mov gs, ax
+    ; gs is left alone, it always holds this CPU's per-CPU segment (see Kernel/cpu.hpp)
+    add dword [gs:CPU_INTERRUPTS_OFFSET], 1
+    adc dword [gs:CPU_INTERRUPTS_OFFSET + 4], 0
 
     call isr_handler
+    call preempt_if_needed ; may switch threads, this one carries on from here when it is resumed
 
     pop eax        ; reload the original data segment descriptor
     mov ds, ax
     mov es, ax
-    mov fs, ax
-    mov gs, ax
 
     popa           ; Pops edi,esi,ebp...
     add esp, 8     ; Cleans up the pushed error code and pushed ISR number
-    sti            ; enable interrupts
     iret           ; pops 5 things at once: CS, EIP, EFLAGS, SS, and ESP,
                    ; Used to restore back to where we were at when the interrupt occured.
 
+
+; IRQ fast path, for vectors 32-255 (see ISR::Frame and ISR::setIRQHandler). Each stub calls its vector's
+; entry in irq_handlers directly, with a pointer to the registers it saved instead of copies of them.
+; The interrupt gate has already cleared IF, and iret restores it, so there is no cli or sti.
+; On the way out, run_deferred runs the bottom halves the handler queued (see Kernel/deferred.hpp).
+; ds and es only need reloading when the interrupt came from user mode (the low bits of the saved cs).
+FRAME_CS_OFFSET equ 44          ; pusha (32), vector, error code, eip
+USER_DATA_SELECTOR equ 0x23     ; GDT::Selectors::user_data, ring 3
+
+extern irq_handlers
+
+%macro IRQ_FAST 1
+    global irq%1
+    irq%1:
+        cld                         ; see the top of this file
+        push dword 0                ; no error code, keeps the frame the same as the exceptions'
+        push dword %1
+        pusha
+        test byte [esp + FRAME_CS_OFFSET], 3
+        jnz irq_from_user
+        add dword [gs:CPU_INTERRUPTS_OFFSET], 1
+        adc dword [gs:CPU_INTERRUPTS_OFFSET + 4], 0
+        push esp                    ; ISR::Frame*
+        call [irq_handlers + %1 * 4]
+        jmp irq_return
+%endmacro
+
+IRQ_FAST 32
+IRQ_FAST 33
+IRQ_FAST 34
+IRQ_FAST 35
+IRQ_FAST 36
+IRQ_FAST 37
+IRQ_FAST 38
+IRQ_FAST 39
+IRQ_FAST 40
+IRQ_FAST 41
+IRQ_FAST 42
+IRQ_FAST 43
+IRQ_FAST 44
+IRQ_FAST 45
+IRQ_FAST 46
+IRQ_FAST 47
+IRQ_FAST 48
+IRQ_FAST 49
+IRQ_FAST 50
+IRQ_FAST 51
+IRQ_FAST 52
+IRQ_FAST 53
+IRQ_FAST 54
+IRQ_FAST 55
+IRQ_FAST 56
+IRQ_FAST 57
+IRQ_FAST 58
+IRQ_FAST 59
+IRQ_FAST 60
+IRQ_FAST 61
+IRQ_FAST 62
+IRQ_FAST 63
+IRQ_FAST 64
+IRQ_FAST 65
+IRQ_FAST 66
+IRQ_FAST 67
+IRQ_FAST 68
+IRQ_FAST 69
+IRQ_FAST 70
+IRQ_FAST 71
+IRQ_FAST 72
+IRQ_FAST 73
+IRQ_FAST 74
+IRQ_FAST 75
+IRQ_FAST 76
+IRQ_FAST 77
+IRQ_FAST 78
+IRQ_FAST 79
+IRQ_FAST 80
+IRQ_FAST 81
+IRQ_FAST 82
+IRQ_FAST 83
+IRQ_FAST 84
+IRQ_FAST 85
+IRQ_FAST 86
+IRQ_FAST 87
+IRQ_FAST 88
+IRQ_FAST 89
+IRQ_FAST 90
+IRQ_FAST 91
+IRQ_FAST 92
+IRQ_FAST 93
+IRQ_FAST 94
+IRQ_FAST 95
+IRQ_FAST 96
+IRQ_FAST 97
+IRQ_FAST 98
+IRQ_FAST 99
+IRQ_FAST 100
+IRQ_FAST 101
+IRQ_FAST 102
+IRQ_FAST 103
+IRQ_FAST 104
+IRQ_FAST 105
+IRQ_FAST 106
+IRQ_FAST 107
+IRQ_FAST 108
+IRQ_FAST 109
+IRQ_FAST 110
+IRQ_FAST 111
+IRQ_FAST 112
+IRQ_FAST 113
+IRQ_FAST 114
+IRQ_FAST 115
+IRQ_FAST 116
+IRQ_FAST 117
+IRQ_FAST 118
+IRQ_FAST 119
+IRQ_FAST 120
+IRQ_FAST 121
+IRQ_FAST 122
+IRQ_FAST 123
+IRQ_FAST 124
+IRQ_FAST 125
+IRQ_FAST 126
+IRQ_FAST 127
+IRQ_FAST 128
+IRQ_FAST 129
+IRQ_FAST 130
+IRQ_FAST 131
+IRQ_FAST 132
+IRQ_FAST 133
+IRQ_FAST 134
+IRQ_FAST 135
+IRQ_FAST 136
+IRQ_FAST 137
+IRQ_FAST 138
+IRQ_FAST 139
+IRQ_FAST 140
+IRQ_FAST 141
+IRQ_FAST 142
+IRQ_FAST 143
+IRQ_FAST 144
+IRQ_FAST 145
+IRQ_FAST 146
+IRQ_FAST 147
+IRQ_FAST 148
+IRQ_FAST 149
+IRQ_FAST 150
+IRQ_FAST 151
+IRQ_FAST 152
+IRQ_FAST 153
+IRQ_FAST 154
+IRQ_FAST 155
+IRQ_FAST 156
+IRQ_FAST 157
+IRQ_FAST 158
+IRQ_FAST 159
+IRQ_FAST 160
+IRQ_FAST 161
+IRQ_FAST 162
+IRQ_FAST 163
+IRQ_FAST 164
+IRQ_FAST 165
+IRQ_FAST 166
+IRQ_FAST 167
+IRQ_FAST 168
+IRQ_FAST 169
+IRQ_FAST 170
+IRQ_FAST 171
+IRQ_FAST 172
+IRQ_FAST 173
+IRQ_FAST 174
+IRQ_FAST 175
+IRQ_FAST 176
+IRQ_FAST 177
+IRQ_FAST 178
+IRQ_FAST 179
+IRQ_FAST 180
+IRQ_FAST 181
+IRQ_FAST 182
+IRQ_FAST 183
+IRQ_FAST 184
+IRQ_FAST 185
+IRQ_FAST 186
+IRQ_FAST 187
+IRQ_FAST 188
+IRQ_FAST 189
+IRQ_FAST 190
+IRQ_FAST 191
+IRQ_FAST 192
+IRQ_FAST 193
+IRQ_FAST 194
+IRQ_FAST 195
+IRQ_FAST 196
+IRQ_FAST 197
+IRQ_FAST 198
+IRQ_FAST 199
+IRQ_FAST 200
+IRQ_FAST 201
+IRQ_FAST 202
+IRQ_FAST 203
+IRQ_FAST 204
+IRQ_FAST 205
+IRQ_FAST 206
+IRQ_FAST 207
+IRQ_FAST 208
+IRQ_FAST 209
+IRQ_FAST 210
+IRQ_FAST 211
+IRQ_FAST 212
+IRQ_FAST 213
+IRQ_FAST 214
+IRQ_FAST 215
+IRQ_FAST 216
+IRQ_FAST 217
+IRQ_FAST 218
+IRQ_FAST 219
+IRQ_FAST 220
+IRQ_FAST 221
+IRQ_FAST 222
+IRQ_FAST 223
+IRQ_FAST 224
+IRQ_FAST 225
+IRQ_FAST 226
+IRQ_FAST 227
+IRQ_FAST 228
+IRQ_FAST 229
+IRQ_FAST 230
+IRQ_FAST 231
+IRQ_FAST 232
+IRQ_FAST 233
+IRQ_FAST 234
+IRQ_FAST 235
+IRQ_FAST 236
+IRQ_FAST 237
+IRQ_FAST 238
+IRQ_FAST 239
+IRQ_FAST 240
+IRQ_FAST 241
+IRQ_FAST 242
+IRQ_FAST 243
+IRQ_FAST 244
+IRQ_FAST 245
+IRQ_FAST 246
+IRQ_FAST 247
+IRQ_FAST 248
+IRQ_FAST 249
+IRQ_FAST 250
+IRQ_FAST 251
+IRQ_FAST 252
+IRQ_FAST 253
+IRQ_FAST 254
+IRQ_FAST 255
+
+irq_return:
+    call run_deferred           ; takes the same ISR::Frame*, may enable interrupts
+    add esp, 4
+    call preempt_if_needed      ; may switch threads, this one carries on from here when it is resumed
+    popa
+    add esp, 8                  ; the vector and error code
+    iret
+
+irq_from_user:
+    mov ax, 0x10
+    mov ds, ax
+    mov es, ax
+    add dword [gs:CPU_INTERRUPTS_OFFSET], 1
+    adc dword [gs:CPU_INTERRUPTS_OFFSET + 4], 0
+    mov eax, [esp + 32]         ; the vector
+    push esp
+    call [irq_handlers + eax * 4]
+    call run_deferred
+    add esp, 4
+    call preempt_if_needed
+    mov ax, USER_DATA_SELECTOR
+    mov ds, ax
+    mov es, ax
+    popa
+    add esp, 8
+    iret
+
+; The addresses of irq32 to irq255, for IDT::init
+section .rodata
+global irq_stub_table
+irq_stub_table:
+    dd irq32
+    dd irq33
+    dd irq34
+    dd irq35
+    dd irq36
+    dd irq37
+    dd irq38
+    dd irq39
+    dd irq40
+    dd irq41
+    dd irq42
+    dd irq43
+    dd irq44
+    dd irq45
+    dd irq46
+    dd irq47
+    dd irq48
+    dd irq49
+    dd irq50
+    dd irq51
+    dd irq52
+    dd irq53
+    dd irq54
+    dd irq55
+    dd irq56
+    dd irq57
+    dd irq58
+    dd irq59
+    dd irq60
+    dd irq61
+    dd irq62
+    dd irq63
+    dd irq64
+    dd irq65
+    dd irq66
+    dd irq67
+    dd irq68
+    dd irq69
+    dd irq70
+    dd irq71
+    dd irq72
+    dd irq73
+    dd irq74
+    dd irq75
+    dd irq76
+    dd irq77
+    dd irq78
+    dd irq79
+    dd irq80
+    dd irq81
+    dd irq82
+    dd irq83
+    dd irq84
+    dd irq85
+    dd irq86
+    dd irq87
+    dd irq88
+    dd irq89
+    dd irq90
+    dd irq91
+    dd irq92
+    dd irq93
+    dd irq94
+    dd irq95
+    dd irq96
+    dd irq97
+    dd irq98
+    dd irq99
+    dd irq100
+    dd irq101
+    dd irq102
+    dd irq103
+    dd irq104
+    dd irq105
+    dd irq106
+    dd irq107
+    dd irq108
+    dd irq109
+    dd irq110
+    dd irq111
+    dd irq112
+    dd irq113
+    dd irq114
+    dd irq115
+    dd irq116
+    dd irq117
+    dd irq118
+    dd irq119
+    dd irq120
+    dd irq121
+    dd irq122
+    dd irq123
+    dd irq124
+    dd irq125
+    dd irq126
+    dd irq127
+    dd irq128
+    dd irq129
+    dd irq130
+    dd irq131
+    dd irq132
+    dd irq133
+    dd irq134
+    dd irq135
+    dd irq136
+    dd irq137
+    dd irq138
+    dd irq139
+    dd irq140
+    dd irq141
+    dd irq142
+    dd irq143
+    dd irq144
+    dd irq145
+    dd irq146
+    dd irq147
+    dd irq148
+    dd irq149
+    dd irq150
+    dd irq151
+    dd irq152
+    dd irq153
+    dd irq154
+    dd irq155
+    dd irq156
+    dd irq157
+    dd irq158
+    dd irq159
+    dd irq160
+    dd irq161
+    dd irq162
+    dd irq163
+    dd irq164
+    dd irq165
+    dd irq166
+    dd irq167
+    dd irq168
+    dd irq169
+    dd irq170
+    dd irq171
+    dd irq172
+    dd irq173
+    dd irq174
+    dd irq175
+    dd irq176
+    dd irq177
+    dd irq178
+    dd irq179
+    dd irq180
+    dd irq181
+    dd irq182
+    dd irq183
+    dd irq184
+    dd irq185
+    dd irq186
+    dd irq187
+    dd irq188
+    dd irq189
+    dd irq190
+    dd irq191
+    dd irq192
+    dd irq193
+    dd irq194
+    dd irq195
+    dd irq196
+    dd irq197
+    dd irq198
+    dd irq199
+    dd irq200
+    dd irq201
+    dd irq202
+    dd irq203
+    dd irq204
+    dd irq205
+    dd irq206
+    dd irq207
+    dd irq208
+    dd irq209
+    dd irq210
+    dd irq211
+    dd irq212
+    dd irq213
+    dd irq214
+    dd irq215
+    dd irq216
+    dd irq217
+    dd irq218
+    dd irq219
+    dd irq220
+    dd irq221
+    dd irq222
+    dd irq223
+    dd irq224
+    dd irq225
+    dd irq226
+    dd irq227
+    dd irq228
+    dd irq229
+    dd irq230
+    dd irq231
+    dd irq232
+    dd irq233
+    dd irq234
+    dd irq235
+    dd irq236
+    dd irq237
+    dd irq238
+    dd irq239
+    dd irq240
+    dd irq241
+    dd irq242
+    dd irq243
+    dd irq244
+    dd irq245
+    dd irq246
+    dd irq247
+    dd irq248
+    dd irq249
+    dd irq250
+    dd irq251
+    dd irq252
+    dd irq253
+    dd irq254
+    dd irq255
@@ -20,14 +20,14 @@ extern "C" void outbyte (uint16_t port, uint8_t data);
  */
 extern "C" uint16_t inbyte (uint16_t port);
 
-// See io_c.c for implementation
+// See io_c.cpp for implementation. Writes go to an off-screen copy, which flush puts on the screen.
 class FrameBuffer {
     private:
     FrameBuffer () = delete;
 
     private:
     // FIXME: This is.. irritating. I can't cast it to a char* if it's static.
-    inline static char* memory = (char*)0x000B8000;
+    inline static char* memory = (char*)(Memory::kernel_virtual_base + 0x000B8000);
 
     static const uint16_t command_port = 0x3D4;
     static const uint16_t data_port = 0x3D5;
@@ -35,6 +35,10 @@ class FrameBuffer {
     static const uint8_t high_byte_command = 14;
     static const uint8_t low_byte_command = 15;
 
+    // flush and scrollView, for callers that hold the lock already
+    static void flushLocked ();
+    static void scrollViewLocked (int32_t lines);
+
     public:
     struct Point {
         uint16_t x;
@@ -46,9 +50,31 @@ class FrameBuffer {
 
     static const uint16_t columns = 80;
     static const uint16_t rows = 25;
+    // Lines kept after they scroll off the screen
+    static const uint32_t scrollback_lines = 4096;
 
     static uint16_t getMaxPosition ();
 
+    /** initialise:
+     * Takes over what is on the screen and where the cursor is, so nothing the bootloader left is lost on
+     * the first flush. Call before anything is written.
+     */
+    static void initialise ();
+    // Copies the rows written since the last flush to the screen and moves the hardware cursor
+    static void flush ();
+    // When enabled (the default), every writeCell/writeString/setCursorPosition flushes when it is done
+    static void setAutoFlush (bool enabled);
+
+    /** scrollView:
+     * Moves the screen through the scrollback history and draws it right away. Writes carry on into the
+     * live screen in the meantime, it is shown again once the view is back at 0.
+     *
+     * @param lines Positive goes back in time, negative forward. Stops at either end.
+     */
+    static void scrollView (int32_t lines);
+    static void viewLive ();
+    static bool isViewingHistory ();
+
     static void setCursorScan (uint8_t start, uint8_t end);
 
     static void disableCursor ();
@@ -75,39 +101,100 @@ namespace SerialPort {
 
     const COMPort LOG = COM1;
 
+    // COM1 is wired to IRQ 4
+    static const uint8_t com1_irq = 4;
+    // Bytes the 16550 transmit FIFO holds
+    static const uint32_t fifo_size = 16;
+    // Must be powers of two
+    static const uint32_t transmit_ring_size = 4096;
+    static const uint32_t receive_ring_size = 1024;
+
     struct LineCommands {
         static const uint8_t enableDLAB = 0x80;
     };
+    struct FIFOCommands {
+        static const uint8_t enable = 0x01;
+        static const uint8_t clearReceive = 0x02;
+        static const uint8_t clearTransmit = 0x04;
+        // Raise the receive interrupt once this many bytes are waiting
+        static const uint8_t trigger8 = 0x80;
+        static const uint8_t trigger14 = 0xC0;
+    };
+    struct InterruptEnable {
+        static const uint8_t receivedData = 0x01;
+        static const uint8_t transmitterEmpty = 0x02;
+        static const uint8_t lineStatus = 0x04;
+        static const uint8_t modemStatus = 0x08;
+    };
+    struct LineStatus {
+        static const uint8_t dataReady = 0x01;
+        static const uint8_t overrunError = 0x02;
+        static const uint8_t transmitterEmpty = 0x20;
+    };
+    struct ModemCommands {
+        static const uint8_t dataTerminalReady = 0x01;
+        static const uint8_t requestToSend = 0x02;
+        // On PCs this gates the UART's interrupt line, without it no IRQ ever arrives
+        static const uint8_t auxiliaryOutput2 = 0x08;
+    };
+
+    // What writeString does when the transmit ring is full
+    enum class OverflowPolicy : uint8_t {
+        // Wait for the UART to make room (sending bytes ourselves if interrupts are off)
+        Block,
+        // Throw the write away and count it in getDroppedCount. Writes longer than a kprintf go in pieces,
+        // only the pieces that didn't fit are thrown away.
+        Drop,
+    };
 
     COMPort getDataPort (COMPort com);
+    COMPort getInterruptEnablePort (COMPort com);
+    // Written: FIFO control. Read: interrupt identification.
     COMPort getFIFOPort (COMPort com);
     COMPort getLinePort (COMPort com);
     COMPort getModemPort (COMPort com);
     COMPort getLineStatusPort (COMPort com);
+    COMPort getModemStatusPort (COMPort com);
 
     void configureBaudRate (COMPort com, uint16_t divisor);
     // TODO: this should be for more than COM1 (logging)
     void configureLine (COMPort com);
+
+    /** initialise:
+     * Configures the port and switches it to interrupt driven transmission and reception: writes go into a
+     * ring buffer and the transmitter-empty interrupt refills the 16 byte FIFO from it, received bytes are
+     * moved from the FIFO into another ring by the receive interrupt. Until this is called, writes
+     * busy-wait on the UART and nothing is received. Needs the IDT and the remapped PIC.
+     *
+     * @param com The port, only one port can be buffered
+     * @param divisor Baud rate divisor, 115200 / divisor is the baud rate
+     */
+    void initialise (COMPort com, uint16_t divisor);
+    void setOverflowPolicy (OverflowPolicy policy);
+    // Number of bytes thrown away because the transmit ring was full
+    uint32_t getDroppedCount ();
+
     bool isTransmitFifoEmpty (COMPort com);
     void writeChar (COMPort com, char c);
     void writeString (COMPort com, const char* str, size_t length);
-    template<size_t S, typename V>
-    void writeDecimal (SerialPort::COMPort com, V val) {
-        // Note: this isn't optimal, but it's easier to write
-        char text[S];
-        Memory::memset(text, 0, sizeof(text));
-
-        size_t div = 1;
-        size_t mod = 10;
-        for (size_t i = 0; i < S; i++) {
-            text[S-i-1] = ((val % mod) / div) + 48;
-            div *= 10;
-            mod *= 10;
-        }
-        for (size_t i = 0; i < S; i++) {
-            SerialPort::writeChar(com, text[i]);
-        }
-    }
+    // With `policy` rather than the one set with setOverflowPolicy, like Drop for code that mustn't wait
+    void writeString (COMPort com, const char* str, size_t length, OverflowPolicy policy);
+    // Busy-waits until everything written so far has been handed to the UART
+    void flush (COMPort com);
+
+    /** read:
+     * Takes received bytes out of the receive ring, without waiting. Only one reader at a time.
+     *
+     * @return The number of bytes stored in `buffer`
+     */
+    size_t read (COMPort com, char* buffer, size_t capacity);
+    bool hasReceived (COMPort com);
+    // Number of received bytes lost, because the UART's FIFO or the receive ring overflowed
+    uint32_t getLostCount ();
+    // For formatted output, see kprintf in format.hpp
+
+    // In com1's IRQ chain, see IRQ::addHandler
+    bool interruptHandler (ISR::Frame* frame);
 };
 
 /*
@@ -167,6 +254,7 @@ namespace PIC {
         };
     };
 
+    // Takes the vector of the interrupt. Drivers should use IRQ::endOfInterrupt, which also covers the APIC.
     extern "C" void sendEOI (uint32_t irq);
 
     /** remapPIC:
@@ -181,14 +269,90 @@ namespace PIC {
     void clearIRQMask (uint8_t IRQ_line);
 };
 
+/*
+    The 8254 PIT (Programmable Interval Timer) counts down from a divisor of its 1.193182 MHz input clock.
+    Channel 0 is wired to IRQ 0, channel 2 to the PC speaker (and can be read back through port 0x61).
+*/
+namespace PIT {
+    static const uint32_t base_frequency = 1193182;
+    static const uint8_t irq = 0;
+
+    static const uint16_t channel0_port = 0x40;
+    static const uint16_t channel2_port = 0x42;
+    static const uint16_t command_port = 0x43;
+    // Keyboard controller port B, which has the channel 2 gate and output
+    static const uint16_t port_b = 0x61;
+
+    struct Commands {
+        static const uint8_t channel0 = 0x00;
+        static const uint8_t channel2 = 0x80;
+        // Access mode: latch the count, so it can be read without it changing under us
+        static const uint8_t latchCount = 0x00;
+        // Access mode: low byte, then high byte
+        static const uint8_t lowHigh = 0x30;
+        // Operating modes
+        static const uint8_t interruptOnTerminalCount = 0x00;
+        static const uint8_t rateGenerator = 0x04;
+        static const uint8_t squareWave = 0x06;
+    };
+    struct PortB {
+        // Channel 2 only counts while this is set
+        static const uint8_t gate2 = 0x01;
+        // Connects channel 2 to the speaker
+        static const uint8_t speakerData = 0x02;
+        // Channel 2's output, read only
+        static const uint8_t output2 = 0x20;
+    };
+
+    /** setPeriodic:
+     * Makes channel 0 raise IRQ 0 at (about) the given frequency.
+     *
+     * @param frequency In Hz, 19 - 1193182
+     * @return The frequency that was really set, the divisor is rounded to a whole number
+     */
+    uint32_t setPeriodic (uint32_t frequency);
+
+    /** setOneShot:
+     * Makes channel 0 raise IRQ 0 once, after `count` cycles of base_frequency, and then stay quiet until
+     * it is programmed again.
+     *
+     * @param count 1 - 65535
+     */
+    void setOneShot (uint16_t count);
+
+    // The current count of channel 0
+    uint16_t readCount ();
+};
+
 namespace PS2Keyboard {
     static const uint16_t data_port = 0x60;
+    static const uint16_t status_port = 0x64;
+    static const uint8_t irq = 1;
+
+    struct Status {
+        // There is a byte to read from data_port
+        static const uint8_t outputFull = 0x01;
+    };
+
+    // Scan code set 1
+    struct ScanCodes {
+        // Comes before the codes of the extended keys
+        static const uint8_t extended = 0xE0;
+        // Set in the code sent when a key is let go
+        static const uint8_t released = 0x80;
+        static const uint8_t left_shift = 0x2A;
+        static const uint8_t right_shift = 0x36;
+        // Extended
+        static const uint8_t page_up = 0x49;
+        static const uint8_t page_down = 0x51;
+    };
 
     void initialise ();
 
     uint8_t readScanCode ();
 
-    void interruptHandler (ISR::Registers regs, ISR::Interrupt int_number, ISR::StackState state);
+    // In IRQ 1's chain, see IRQ::addHandler
+    bool interruptHandler (ISR::Frame* frame);
 };
 
 #endif
\ No newline at end of file
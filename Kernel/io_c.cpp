@@ -1,4 +1,9 @@
 #include "io.hpp"
+#include "format.hpp"
+#include "irq.hpp"
+#include "deferred.hpp"
+#include "spinlock.hpp"
+#include "general_assembly.hpp"
 
 /* Framebuffer:
     Has 80 columns and 25 rows. The row and column indices start at 0.
@@ -28,25 +33,298 @@
     out 0x3D4, 15
     out 0x3d5, 0x50
     ```
+
+    Shadow buffer:
+    VGA memory is uncached and slow to read, and the cursor registers cost two port writes per byte. So all
+    writes go to `shadow`, a copy of VGA memory in normal RAM, and the cursor is only tracked in `cursor`.
+    Each write marks its screen row in `dirty_rows`. flush copies the dirty rows to VGA memory with 32-bit
+    stores and programs the CRTC registers once, if the cursor moved or the screen scrolled. writeCell and
+    writeString flush when they are done unless auto flush has been turned off, in which case whoever
+    turned it off calls flush.
+
+    Scrolling:
+    The screen shows 25 of the 204 rows that fit into the 32 KiB at 0xB8000, starting at the row in
+    `top_row`. The CRTC start address (registers 0x0C/0x0D) tells the VGA where that is. Scrolling by a line
+    moves `top_row` down and clears the new last row, and since every other row is already in VGA memory
+    only that one is dirty. Once the last row would fall off the end, the visible rows are moved back to
+    the start in one bulk copy, so that happens once every 180 lines.
+    The cursor location register counts from the start of VGA memory too, not from the start address.
+
+    Scrollback:
+    Each row that scrolls off the top is copied into `scrollback`, a ring of the last 4096 lines. It is a
+    static array, so it keeps working when the heap (or anything else) is broken. Shift+PgUp/PgDn move
+    `view_offset` back and forth through it, and while it isn't 0, flush draws the 25 rows of the window
+    into VGA memory instead of the dirty live rows (which stay dirty until the view returns). Output that
+    arrives meanwhile moves the window along with it, so the text being read stays put.
 */
 
+namespace {
+    // 32 KiB of text memory, in whole rows
+    const uint16_t vga_rows = 0x8000 / (FrameBuffer::columns * sizeof(uint16_t));
+
+    // Every cell as it should be in VGA memory
+    uint16_t shadow[vga_rows * FrameBuffer::columns];
+    // The VGA row at the top of the screen
+    uint16_t top_row = 0;
+    // Bit n is set when screen row n hasn't been copied to VGA memory yet
+    uint32_t dirty_rows = 0;
+    // Relative to the top of the screen
+    uint16_t cursor = 0;
+    bool cursor_dirty = false;
+    bool start_dirty = false;
+    bool auto_flush = true;
+
+    uint16_t scrollback[FrameBuffer::scrollback_lines * FrameBuffer::columns];
+    // Number of lines ever added, the newest is at (scrollback_head - 1) % scrollback_lines
+    uint32_t scrollback_head = 0;
+    uint32_t scrollback_count = 0;
+    // How many lines the screen shows above the live screen, 0 when it shows the live screen
+    uint32_t view_offset = 0;
+    // The window has moved and has to be drawn again
+    bool view_dirty = false;
+
+    // Everything above, and the CRTC registers (an index port and a data port). Taken by every public
+    // FrameBuffer function, with interrupts off, since interrupt handlers write to the screen as well.
+    Spinlock::Ticket frame_buffer_lock;
+
+    const uint32_t all_rows = (1u << FrameBuffer::rows) - 1;
+    // White space on black
+    const uint16_t blank_cell = (15 << 8) | ' ';
+
+    namespace CRTC {
+        const uint8_t start_address_high = 0x0C;
+        const uint8_t start_address_low = 0x0D;
+    };
+
+    uint16_t makeCell (char chr, FrameBuffer::Foreground foreground, FrameBuffer::Background background) {
+        return (uint8_t)chr | ((((foreground & 0x0F) << 4) | (background & 0x0F)) << 8);
+    }
+
+    // The shadow cell that is shown at the given screen position
+    uint16_t& cellAt (uint16_t absolute_position) {
+        return shadow[top_row * FrameBuffer::columns + absolute_position];
+    }
+
+    void markDirty (uint16_t absolute_position) {
+        dirty_rows |= 1u << (absolute_position / FrameBuffer::columns);
+    }
+
+    // Screen row `row` of the scrollback window
+    const uint16_t* getViewRow (uint16_t row) {
+        // Index into the history followed by the live screen
+        uint32_t line = scrollback_count - view_offset + row;
+        if (line < scrollback_count) {
+            uint32_t index = (scrollback_head - scrollback_count + line) % FrameBuffer::scrollback_lines;
+            return &scrollback[index * FrameBuffer::columns];
+        }
+        return &cellAt((line - scrollback_count) * FrameBuffer::columns);
+    }
+
+    void scrollLine () {
+        Memory::memcpy(&scrollback[(scrollback_head % FrameBuffer::scrollback_lines) * FrameBuffer::columns], &cellAt(0), FrameBuffer::columns * sizeof(uint16_t));
+        scrollback_head++;
+        if (scrollback_count < FrameBuffer::scrollback_lines) {
+            scrollback_count++;
+        }
+        if (view_offset != 0) {
+            if (view_offset < scrollback_count) {
+                // Keep showing the same lines
+                view_offset++;
+            }
+            // top_row moves, and the window has to be drawn where it moves to
+            view_dirty = true;
+        }
+
+        if (top_row + FrameBuffer::rows == vga_rows) {
+            // Out of rows, start over at the beginning of VGA memory
+            Memory::memmove(shadow, &cellAt(FrameBuffer::columns), FrameBuffer::columns * (FrameBuffer::rows - 1) * sizeof(uint16_t));
+            top_row = 0;
+            dirty_rows = all_rows;
+        } else {
+            top_row++;
+            // Screen row n is now what row n + 1 was
+            dirty_rows >>= 1;
+        }
+
+        const uint16_t last_row = FrameBuffer::columns * (FrameBuffer::rows - 1);
+        for (uint16_t i = last_row; i <= FrameBuffer::getMaxPosition(); i++) {
+            cellAt(i) = blank_cell;
+        }
+        markDirty(last_row);
+        start_dirty = true;
+    }
+
+    // writeCell without the flush
+    void putCell (char chr, FrameBuffer::Foreground foreground, FrameBuffer::Background background) {
+        uint16_t pos = cursor;
+
+        if (chr == '\n') {
+            // Move to next line
+            pos += FrameBuffer::columns;
+            // Move back to start of line
+            pos -= pos % FrameBuffer::columns;
+        } else {
+            cellAt(pos) = makeCell(chr, foreground, background);
+            markDirty(pos);
+            pos++;
+        }
+
+        if (pos > FrameBuffer::getMaxPosition()) {
+            scrollLine();
+            pos = FrameBuffer::columns * (FrameBuffer::rows - 1);
+        }
+
+        cursor = pos;
+        cursor_dirty = true;
+    }
+}
+
+void FrameBuffer::initialise () {
+    // The bootloader leaves the start address at 0
+    for (uint16_t i = 0; i < columns * rows; i++) {
+        shadow[i] = ((volatile uint16_t*)memory)[i];
+    }
+    top_row = 0;
+
+    outbyte(command_port, low_byte_command);
+    // inbyte only sets the low byte
+    cursor = (uint8_t)inbyte(data_port);
+    outbyte(command_port, high_byte_command);
+    cursor |= ((uint16_t)(uint8_t)inbyte(data_port)) << 8;
+    if (cursor > getMaxPosition()) {
+        cursor = 0;
+    }
+
+    dirty_rows = 0;
+    cursor_dirty = false;
+    // Make sure it really is 0
+    start_dirty = true;
+    Spinlock::addStats(frame_buffer_lock.stats, "frame buffer");
+}
+
+void FrameBuffer::setAutoFlush (bool enabled) {
+    auto_flush = enabled;
+}
+
+void FrameBuffer::flushLocked () {
+    // Two cells per store
+    volatile uint32_t* screen = (volatile uint32_t*)memory;
+    const uint32_t* source = (const uint32_t*)shadow;
+    const uint32_t words_per_row = columns / 2;
+
+    if (view_offset != 0) {
+        if (view_dirty) {
+            view_dirty = false;
+            for (uint16_t row = 0; row < rows; row++) {
+                const uint32_t* view_row = (const uint32_t*)getViewRow(row);
+                volatile uint32_t* screen_row = screen + (top_row + row) * words_per_row;
+                for (uint32_t i = 0; i < words_per_row; i++) {
+                    screen_row[i] = view_row[i];
+                }
+            }
+            start_dirty = true;
+        }
+    }
+
+    uint32_t rows_to_copy = view_offset == 0 ? dirty_rows : 0;
+    dirty_rows &= ~rows_to_copy;
+    while (rows_to_copy != 0) {
+        uint32_t row = top_row + __builtin_ctz(rows_to_copy);
+        rows_to_copy &= rows_to_copy - 1;
+        for (uint32_t i = row * words_per_row; i < (row + 1) * words_per_row; i++) {
+            screen[i] = source[i];
+        }
+    }
+
+    uint16_t start = top_row * columns;
+    if (start_dirty) {
+        start_dirty = false;
+        outbyte(command_port, CRTC::start_address_high);
+        outbyte(data_port, (start >> 8) & 0x00FF);
+        outbyte(command_port, CRTC::start_address_low);
+        outbyte(data_port, start & 0x00FF);
+        // The cursor is stored relative to the start of VGA memory, so it moved as well
+        cursor_dirty = true;
+    }
+
+    if (cursor_dirty) {
+        cursor_dirty = false;
+        // Past the end of the screen hides it, while the history is shown
+        uint16_t position = start + (view_offset == 0 ? cursor : columns * rows);
+        outbyte(command_port, high_byte_command);
+        outbyte(data_port, ((position >> 8) & 0x00FF)); // Isolate most significant byte
+        outbyte(command_port, low_byte_command);
+        outbyte(data_port, position & 0x00FF);
+    }
+}
+
+void FrameBuffer::scrollViewLocked (int32_t lines) {
+    int32_t offset = (int32_t)view_offset + lines;
+    if (offset < 0) {
+        offset = 0;
+    } else if ((uint32_t)offset > scrollback_count) {
+        offset = scrollback_count;
+    }
+    if ((uint32_t)offset == view_offset) {
+        return;
+    }
+
+    bool was_live = view_offset == 0;
+    view_offset = offset;
+    if (view_offset == 0) {
+        // Everything on the screen is from the history now
+        dirty_rows = all_rows;
+        cursor_dirty = true;
+    } else {
+        view_dirty = true;
+        if (was_live) {
+            cursor_dirty = true;
+        }
+    }
+    flushLocked();
+}
+
+void FrameBuffer::flush () {
+    uint32_t flags = Spinlock::lockIRQSave(frame_buffer_lock);
+    flushLocked();
+    Spinlock::unlockIRQRestore(frame_buffer_lock, flags);
+}
+
+void FrameBuffer::scrollView (int32_t lines) {
+    uint32_t flags = Spinlock::lockIRQSave(frame_buffer_lock);
+    scrollViewLocked(lines);
+    Spinlock::unlockIRQRestore(frame_buffer_lock, flags);
+}
+void FrameBuffer::viewLive () {
+    uint32_t flags = Spinlock::lockIRQSave(frame_buffer_lock);
+    scrollViewLocked(-(int32_t)view_offset);
+    Spinlock::unlockIRQRestore(frame_buffer_lock, flags);
+}
+bool FrameBuffer::isViewingHistory () {
+    return view_offset != 0;
+}
+
 uint16_t FrameBuffer::getMaxPosition () {
     return columns*rows - 1;
 }
 
 void FrameBuffer::setCursorScan (uint8_t start, uint8_t end) {
+    uint32_t flags = Spinlock::lockIRQSave(frame_buffer_lock);
     outbyte(command_port, 10);
     outbyte(data_port, (inbyte(data_port) & 0xC0) | start);
 
     outbyte(command_port, 11);
     outbyte(data_port, (inbyte(data_port) & 0xE0) | end);
+    Spinlock::unlockIRQRestore(frame_buffer_lock, flags);
 }
 
 void FrameBuffer::disableCursor () {
+    uint32_t flags = Spinlock::lockIRQSave(frame_buffer_lock);
     // 10 = low cursor shape register
     outbyte(command_port, 10);
     // bits 6-7 unused, bit 5 disables cursor, bits 0-4 control the shape
     outbyte(data_port, 0x20);
+    Spinlock::unlockIRQRestore(frame_buffer_lock, flags);
 }
 
 void FrameBuffer::setCursorPosition (uint16_t x, uint16_t y) {
@@ -61,29 +339,20 @@ void FrameBuffer::setAbsoluteCursorPosition (uint16_t absolute_position) {
         return;
     }
 
-    outbyte(command_port, high_byte_command);
-    outbyte(data_port, ((absolute_position >> 8) & 0x00FF)); // Isolate most significant byte
-
-    outbyte(command_port, low_byte_command);
-    outbyte(data_port, absolute_position & 0x00FF);
+    uint32_t flags = Spinlock::lockIRQSave(frame_buffer_lock);
+    cursor = absolute_position;
+    cursor_dirty = true;
+    if (auto_flush) {
+        flushLocked();
+    }
+    Spinlock::unlockIRQRestore(frame_buffer_lock, flags);
 }
 
 uint16_t FrameBuffer::getAbsoluteCursorPosition () {
-    uint16_t pos = 0;
-
-    outbyte(command_port, 15);
-    pos |= inbyte(data_port);
-    outbyte(command_port, 0x0E);
-    pos |= ((uint16_t)inbyte(data_port)) << 8;
-
-    return pos;
+    return cursor;
 }
 FrameBuffer::Point FrameBuffer::getCursorPosition () {
-    uint16_t pos = getAbsoluteCursorPosition();
-    uint16_t y = pos % columns;
-    uint16_t x = pos - y;
-    // TODO: check this code
-    return FrameBuffer::Point(x, y);
+    return FrameBuffer::Point(cursor % columns, cursor / columns);
 }
 
 void FrameBuffer::writeCellAt (uint16_t absolute_position, char chr, FrameBuffer::Foreground foreground, FrameBuffer::Background background) {
@@ -91,67 +360,58 @@ void FrameBuffer::writeCellAt (uint16_t absolute_position, char chr, FrameBuffer
         // Fail silently.
         return;
     }
-    // [chr byte][foreground 4bits][background 4bits]
-    //((char*)memory)[absolute_position * 2] = chr; // Set first byte to the character
-    //((char*)memory)[absolute_position * 2 + 1] = ((foreground & 0x0F) << 4) | (background & 0x0F);
-    writeCellCharacterAt(absolute_position, chr);
-    writeCellForegroundAt(absolute_position, foreground);
-    writeCellBackgroundAt(absolute_position, background);
+    uint32_t flags = Spinlock::lockIRQSave(frame_buffer_lock);
+    cellAt(absolute_position) = makeCell(chr, foreground, background);
+    markDirty(absolute_position);
+    Spinlock::unlockIRQRestore(frame_buffer_lock, flags);
 }
 void FrameBuffer::writeCellBackgroundAt (uint16_t absolute_position, FrameBuffer::Background background) {
     if (absolute_position > getMaxPosition()) {
         // Fail silently.
         return;
     }
-    uint8_t v = memory[absolute_position * 2 + 1];
-    memory[absolute_position * 2 + 1] = (v & 0b11110000) | (background & 0x0F);
+    uint32_t flags = Spinlock::lockIRQSave(frame_buffer_lock);
+    cellAt(absolute_position) = (cellAt(absolute_position) & 0xF0FF) | ((background & 0x0F) << 8);
+    markDirty(absolute_position);
+    Spinlock::unlockIRQRestore(frame_buffer_lock, flags);
 }
 void FrameBuffer::writeCellForegroundAt (uint16_t absolute_position, FrameBuffer::Foreground foreground) {
     if (absolute_position > getMaxPosition()) {
         // Fail silently.
         return;
     }
-    uint8_t v = memory[absolute_position * 2 + 1];
-    memory[absolute_position * 2 + 1] = (v & 0b00001111) | ((foreground & 0x0F) << 4);
+    uint32_t flags = Spinlock::lockIRQSave(frame_buffer_lock);
+    cellAt(absolute_position) = (cellAt(absolute_position) & 0x0FFF) | ((foreground & 0x0F) << 12);
+    markDirty(absolute_position);
+    Spinlock::unlockIRQRestore(frame_buffer_lock, flags);
 }
 void FrameBuffer::writeCellCharacterAt (uint16_t absolute_position, char chr) {
     if (absolute_position > getMaxPosition()) {
         // Fail silently.
         return;
     }
-    memory[absolute_position * 2] = chr;
+    uint32_t flags = Spinlock::lockIRQSave(frame_buffer_lock);
+    cellAt(absolute_position) = (cellAt(absolute_position) & 0xFF00) | (uint8_t)chr;
+    markDirty(absolute_position);
+    Spinlock::unlockIRQRestore(frame_buffer_lock, flags);
 }
 void FrameBuffer::writeCell (char chr, FrameBuffer::Foreground foreground, FrameBuffer::Background background) {
-    uint16_t pos = getAbsoluteCursorPosition();
-
-    if (chr == '\n') {
-        // Move to next line
-        pos += columns;
-        // Move back to start of line
-        pos -= pos % columns;
-    } else {
-        writeCellAt(pos, chr, foreground, background);
-        pos++;
-    }
-
-    if (pos > getMaxPosition()) {
-        for (size_t i = 0; i < columns * (rows - 1); i++) {
-            memory[i * 2] = memory[(i + columns) * 2];
-            memory[i * 2 + 1] = memory[(i + columns) * 2 + 1];
-        }
-        for (size_t i = columns * (rows - 1); i < columns * rows; i++) {
-            memory[i * 2] = ' ';
-            memory[i * 2 + 1] = 15;
-        }
-        pos = getMaxPosition() - columns + 1;
+    uint32_t flags = Spinlock::lockIRQSave(frame_buffer_lock);
+    putCell(chr, foreground, background);
+    if (auto_flush) {
+        flushLocked();
     }
-
-    setAbsoluteCursorPosition(pos);
+    Spinlock::unlockIRQRestore(frame_buffer_lock, flags);
 }
 void FrameBuffer::writeString (const char* str, size_t length, FrameBuffer::Foreground foreground, FrameBuffer::Background background) {
+    uint32_t flags = Spinlock::lockIRQSave(frame_buffer_lock);
     for (size_t i = 0; i < length; i++) {
-        writeCell(str[i], foreground, background);
+        putCell(str[i], foreground, background);
     }
+    if (auto_flush) {
+        flushLocked();
+    }
+    Spinlock::unlockIRQRestore(frame_buffer_lock, flags);
 }
 
 
@@ -164,11 +424,153 @@ void FrameBuffer::writeString (const char* str, size_t length, FrameBuffer::Fore
 
     All of the I/O ports a relative to the data port. All serial ports (COM1, COM2, COM3, COM4) have their ports in the same order
     but they start at different values.
+
+    Transmission is interrupt driven once initialise has been called. Writers copy into `transmit_ring` and
+    return, and the transmitter-empty interrupt (IRQ 4) moves up to 16 bytes at a time from the ring into
+    the UART's FIFO. Any context can write, including interrupt handlers, so the ring never takes a lock:
+        - A writer reserves space by moving `head` forward with a compare-and-swap, copies its bytes in
+          and marks each slot as ready. Bytes only become visible to the sender once marked. Reserving and
+          filling are done with interrupts off, `transmit_chunk_size` bytes at a time, so a reservation is
+          never left unfilled by a writer that was interrupted. Otherwise a writer in the interrupt (or in
+          deferred work on top of the interrupted thread) could wait forever for the sender to get past it.
+        - Sending is done by whoever holds `sending` (the interrupt handler, or a writer that found the FIFO
+          empty). It sends ready slots in order, clears them and moves `tail` forward. It is held with
+          interrupts off, so a holder is never stuck behind code that interrupted it.
+        - A writer that can't get `sending` relies on the holder, which checks for new bytes after letting go.
+
+    Reception is the other way around: the receive interrupt (raised at 8 waiting bytes, or when bytes have
+    sat in the FIFO for 4 character times) empties the whole FIFO into `receive_ring`, and a single reader
+    takes them out with SerialPort::read. At 115200 baud a byte arrives every ~87 us, so the 8 free FIFO
+    slots give interrupt handlers ~700 us to finish before bytes are lost.
 */
 
+namespace {
+    struct TransmitRing {
+        char data[SerialPort::transmit_ring_size];
+        // 1 once the writer that reserved the slot has filled it in
+        uint8_t ready[SerialPort::transmit_ring_size];
+        // Next position to reserve, only moved by compare-and-swap
+        uint32_t head;
+        // Next position to send, only moved by the holder of `sending`
+        uint32_t tail;
+        uint32_t sending;
+        uint32_t dropped;
+    };
+
+    // Single producer (the interrupt handler), single consumer (SerialPort::read)
+    struct ReceiveRing {
+        char data[SerialPort::receive_ring_size];
+        uint32_t head;
+        uint32_t tail;
+        uint32_t lost;
+    };
+
+    const uint32_t transmit_ring_mask = SerialPort::transmit_ring_size - 1;
+    // The most a writer copies in with interrupts off, a whole kprintf so that lines aren't split
+    const uint32_t transmit_chunk_size = Format::print_buffer_size;
+    const uint32_t receive_ring_mask = SerialPort::receive_ring_size - 1;
+
+    TransmitRing transmit_ring;
+    ReceiveRing receive_ring;
+    // The port whose writes go through transmit_ring, 0 until SerialPort::initialise
+    SerialPort::COMPort buffered_com = 0;
+    SerialPort::OverflowPolicy overflow_policy = SerialPort::OverflowPolicy::Block;
+    IRQ::Handler serial_handler;
+
+    bool reserveTransmit (uint32_t count, uint32_t& start) {
+        uint32_t head = __atomic_load_n(&transmit_ring.head, __ATOMIC_RELAXED);
+        do {
+            uint32_t tail = __atomic_load_n(&transmit_ring.tail, __ATOMIC_ACQUIRE);
+            if (head - tail + count > SerialPort::transmit_ring_size) {
+                return false;
+            }
+        } while (!__atomic_compare_exchange_n(&transmit_ring.head, &head, head + count, true, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+        start = head;
+        return true;
+    }
+
+    bool hasReadyByte () {
+        uint32_t tail = __atomic_load_n(&transmit_ring.tail, __ATOMIC_RELAXED);
+        return __atomic_load_n(&transmit_ring.ready[tail & transmit_ring_mask], __ATOMIC_ACQUIRE) != 0;
+    }
+
+    // Fills the UART FIFO from the ring, if it is empty. Caller holds `sending`.
+    void sendReady (SerialPort::COMPort com) {
+        if (!SerialPort::isTransmitFifoEmpty(com)) {
+            return;
+        }
+        uint32_t tail = transmit_ring.tail;
+        for (uint32_t i = 0; i < SerialPort::fifo_size; i++) {
+            uint32_t index = tail & transmit_ring_mask;
+            if (__atomic_load_n(&transmit_ring.ready[index], __ATOMIC_ACQUIRE) == 0) {
+                break;
+            }
+            outbyte(SerialPort::getDataPort(com), transmit_ring.data[index]);
+            transmit_ring.ready[index] = 0;
+            tail++;
+        }
+        // Slots are only reused once tail has passed them
+        __atomic_store_n(&transmit_ring.tail, tail, __ATOMIC_RELEASE);
+    }
+
+    // Moves everything in the UART's receive FIFO into the ring
+    void receiveAll (SerialPort::COMPort com) {
+        uint32_t head = receive_ring.head;
+        uint32_t tail = __atomic_load_n(&receive_ring.tail, __ATOMIC_ACQUIRE);
+        uint8_t status;
+        while ((status = inbyte(SerialPort::getLineStatusPort(com))) & SerialPort::LineStatus::dataReady) {
+            if (status & SerialPort::LineStatus::overrunError) {
+                // The FIFO was full and at least one byte has been thrown away by the UART
+                receive_ring.lost++;
+            }
+            char chr = inbyte(SerialPort::getDataPort(com));
+            if (head - tail == SerialPort::receive_ring_size) {
+                receive_ring.lost++;
+                continue;
+            }
+            receive_ring.data[head & receive_ring_mask] = chr;
+            head++;
+        }
+        __atomic_store_n(&receive_ring.head, head, __ATOMIC_RELEASE);
+    }
+
+    void kickTransmit (SerialPort::COMPort com) {
+        uint32_t flags = saveAndDisableInterrupts();
+        while (__atomic_exchange_n(&transmit_ring.sending, 1, __ATOMIC_ACQUIRE) == 0) {
+            sendReady(com);
+            __atomic_store_n(&transmit_ring.sending, 0, __ATOMIC_RELEASE);
+
+            // A writer may have published while we held `sending` and given up on sending itself.
+            // If the FIFO isn't empty the next transmitter-empty interrupt picks those bytes up.
+            if (!hasReadyByte() || !SerialPort::isTransmitFifoEmpty(com)) {
+                break;
+            }
+        }
+        restoreInterrupts(flags);
+    }
+
+    // Called with a full ring. Returns false if the write should be dropped instead.
+    bool waitForTransmitSpace (SerialPort::COMPort com, SerialPort::OverflowPolicy policy) {
+        if (policy == SerialPort::OverflowPolicy::Drop) {
+            return false;
+        }
+        // With interrupts off (in a handler, under a lockIRQSave, in a panic) the transmit interrupt can't
+        // come, so this polls the UART and sends the ring itself. Neither `sending` nor an unfilled slot is
+        // ever held by code this interrupted, so kickTransmit either sends or another CPU is about to.
+        while (!SerialPort::isTransmitFifoEmpty(com)) {
+            __asm__ volatile ("pause");
+        }
+        kickTransmit(com);
+        return true;
+    }
+}
+
 SerialPort::COMPort SerialPort::getDataPort (SerialPort::COMPort com) {
     return com;
 }
+SerialPort::COMPort SerialPort::getInterruptEnablePort (SerialPort::COMPort com) {
+    return com + 1;
+}
 SerialPort::COMPort SerialPort::getFIFOPort (SerialPort::COMPort com) {
     return com + 2;
 }
@@ -181,12 +583,16 @@ SerialPort::COMPort SerialPort::getModemPort (SerialPort::COMPort com) {
 SerialPort::COMPort SerialPort::getLineStatusPort (SerialPort::COMPort com) {
     return com + 5;
 }
+SerialPort::COMPort SerialPort::getModemStatusPort (SerialPort::COMPort com) {
+    return com + 6;
+}
 
 void SerialPort::configureBaudRate (SerialPort::COMPort com, uint16_t divisor) {
     outbyte(getLinePort(com), SerialPort::LineCommands::enableDLAB);
 
-    outbyte(getDataPort(com), (divisor >> 8) & 0x00FF);
+    // With DLAB set, the data port is the low byte of the divisor and the interrupt enable port the high byte
     outbyte(getDataPort(com), divisor & 0x00FF);
+    outbyte(getInterruptEnablePort(com), (divisor >> 8) & 0x00FF);
 }
 void SerialPort::configureLine (SerialPort::COMPort com) {
     /*
@@ -198,35 +604,144 @@ void SerialPort::configureLine (SerialPort::COMPort com) {
     */
    outbyte(getLinePort(com), 0b00000011);
 }
+
+void SerialPort::initialise (SerialPort::COMPort com, uint16_t divisor) {
+    outbyte(getInterruptEnablePort(com), 0);
+    configureBaudRate(com, divisor);
+    configureLine(com);
+    outbyte(getFIFOPort(com), FIFOCommands::enable | FIFOCommands::clearReceive | FIFOCommands::clearTransmit | FIFOCommands::trigger8);
+    outbyte(getModemPort(com), ModemCommands::dataTerminalReady | ModemCommands::requestToSend | ModemCommands::auxiliaryOutput2);
+
+    IRQ::addHandler(com1_irq, serial_handler, IRQ::HandlerFunction::fromFunction<SerialPort::interruptHandler>(), "serial");
+    buffered_com = com;
+    // The transmit interrupt fires each time the FIFO runs empty, so it can stay enabled while there is
+    // nothing to send
+    outbyte(getInterruptEnablePort(com), InterruptEnable::receivedData | InterruptEnable::transmitterEmpty | InterruptEnable::lineStatus);
+    IRQ::unmask(com1_irq);
+}
+
+void SerialPort::setOverflowPolicy (SerialPort::OverflowPolicy policy) {
+    overflow_policy = policy;
+}
+uint32_t SerialPort::getDroppedCount () {
+    return __atomic_load_n(&transmit_ring.dropped, __ATOMIC_RELAXED);
+}
+
 bool SerialPort::isTransmitFifoEmpty (SerialPort::COMPort com) {
-    return inbyte(getLineStatusPort(com)) & 0b00100000;
+    return inbyte(getLineStatusPort(com)) & LineStatus::transmitterEmpty;
 }
 void SerialPort::writeChar (SerialPort::COMPort com, char c) {
-    while (!isTransmitFifoEmpty(com));
-    outbyte(com, c);
+    writeString(com, &c, 1);
 }
 void SerialPort::writeString (SerialPort::COMPort com, const char* str, size_t length) {
-    for (size_t i = 0; i < length; i++) {
-        writeChar(com, str[i]);
+    writeString(com, str, length, overflow_policy);
+}
+void SerialPort::writeString (SerialPort::COMPort com, const char* str, size_t length, SerialPort::OverflowPolicy policy) {
+    if (com != buffered_com) {
+        for (size_t i = 0; i < length; i++) {
+            while (!isTransmitFifoEmpty(com));
+            outbyte(com, str[i]);
+        }
+        return;
+    }
+
+    while (length > 0) {
+        uint32_t count = length < transmit_chunk_size ? length : transmit_chunk_size;
+        uint32_t start;
+        uint32_t flags = saveAndDisableInterrupts();
+        while (!reserveTransmit(count, start)) {
+            // The wait itself needn't keep interrupts off, nothing is reserved yet
+            restoreInterrupts(flags);
+            if (!waitForTransmitSpace(com, policy)) {
+                __atomic_fetch_add(&transmit_ring.dropped, length, __ATOMIC_RELAXED);
+                return;
+            }
+            flags = saveAndDisableInterrupts();
+        }
+
+        for (uint32_t i = 0; i < count; i++) {
+            uint32_t index = (start + i) & transmit_ring_mask;
+            transmit_ring.data[index] = str[i];
+            __atomic_store_n(&transmit_ring.ready[index], 1, __ATOMIC_RELEASE);
+        }
+        restoreInterrupts(flags);
+        kickTransmit(com);
+
+        str += count;
+        length -= count;
+    }
+}
+void SerialPort::flush (SerialPort::COMPort com) {
+    if (com != buffered_com) {
+        return;
+    }
+    while (__atomic_load_n(&transmit_ring.tail, __ATOMIC_ACQUIRE) != __atomic_load_n(&transmit_ring.head, __ATOMIC_ACQUIRE)) {
+        while (!isTransmitFifoEmpty(com)) {
+            __asm__ volatile ("pause");
+        }
+        kickTransmit(com);
     }
 }
 
+size_t SerialPort::read (SerialPort::COMPort com, char* buffer, size_t capacity) {
+    if (com != buffered_com) {
+        return 0;
+    }
+    uint32_t tail = receive_ring.tail;
+    uint32_t head = __atomic_load_n(&receive_ring.head, __ATOMIC_ACQUIRE);
+    size_t count = 0;
+    while (tail != head && count < capacity) {
+        buffer[count++] = receive_ring.data[tail & receive_ring_mask];
+        tail++;
+    }
+    __atomic_store_n(&receive_ring.tail, tail, __ATOMIC_RELEASE);
+    return count;
+}
+bool SerialPort::hasReceived (SerialPort::COMPort com) {
+    return com == buffered_com && __atomic_load_n(&receive_ring.head, __ATOMIC_ACQUIRE) != receive_ring.tail;
+}
+uint32_t SerialPort::getLostCount () {
+    return __atomic_load_n(&receive_ring.lost, __ATOMIC_RELAXED);
+}
 
-extern "C" void PIC::sendEOI (uint32_t irq) {
-    if (irq < PIC::PIC1::start_interrupt || irq > PIC::PIC2::end_interrupt) {
-        //return;
+bool SerialPort::interruptHandler (ISR::Frame*) {
+    SerialPort::COMPort com = buffered_com;
+    bool handled = false;
+    // Bit 0 is clear while an interrupt is pending, bits 1-3 say which. Reading it acknowledges a
+    // transmitter-empty interrupt, the others are acknowledged by reading the register they are about.
+    uint8_t identification;
+    while (((identification = inbyte(getFIFOPort(com))) & 0x01) == 0) {
+        handled = true;
+        switch ((identification >> 1) & 0x07) {
+            case 0: // Modem status changed
+                inbyte(getModemStatusPort(com));
+                break;
+            case 1: // Transmit FIFO empty
+                kickTransmit(com);
+                break;
+            case 2: // Received data reached the trigger level
+            case 6: // Received data has been waiting for a while
+                receiveAll(com);
+                break;
+            case 3: // Line status (overrun, framing error, ...)
+                if (inbyte(getLineStatusPort(com)) & LineStatus::overrunError) {
+                    receive_ring.lost++;
+                }
+                break;
+            default:
+                break;
+        }
     }
+    return handled;
+}
+
 
-    if (irq >= 8) {
+extern "C" void PIC::sendEOI (uint32_t irq) {
+    // Takes the vector, only interrupts that came through the slave need it acknowledged as well
+    if (irq >= PIC::PIC2::start_interrupt && irq <= PIC::PIC2::end_interrupt) {
         outbyte(PIC2::command, Commands::EOI);
     }
     outbyte(PIC1::command, Commands::EOI);
-
-    //if (irq < PIC::PIC2::start_interrupt) {
-      //  outbyte(PIC::PIC1::command, PIC::Commands::EOI);
-    //} else {
-      //  outbyte(PIC::PIC2::command, PIC::Commands::EOI);
-    //}
 }
 
 extern "C" void PIC::remapPIC () {
@@ -287,22 +802,134 @@ void PIC::clearIRQMask (uint8_t IRQ_line) {
 }
 
 
+uint32_t PIT::setPeriodic (uint32_t frequency) {
+    uint32_t divisor = (base_frequency + frequency / 2) / frequency;
+    if (divisor < 2) {
+        divisor = 2;
+    } else if (divisor > 0xFFFF) {
+        divisor = 0xFFFF;
+    }
+
+    outbyte(command_port, Commands::channel0 | Commands::lowHigh | Commands::rateGenerator);
+    outbyte(channel0_port, divisor & 0xFF);
+    outbyte(channel0_port, (divisor >> 8) & 0xFF);
+
+    return (base_frequency + divisor / 2) / divisor;
+}
+
+void PIT::setOneShot (uint16_t count) {
+    outbyte(command_port, Commands::channel0 | Commands::lowHigh | Commands::interruptOnTerminalCount);
+    outbyte(channel0_port, count & 0xFF);
+    outbyte(channel0_port, (count >> 8) & 0xFF);
+}
+
+uint16_t PIT::readCount () {
+    outbyte(command_port, Commands::channel0 | Commands::latchCount);
+    // inbyte only sets the low byte
+    uint16_t count = (uint8_t)inbyte(channel0_port);
+    count |= ((uint16_t)(uint8_t)inbyte(channel0_port)) << 8;
+    return count;
+}
+
+
+/* PS/2 Keyboard:
+    Scan code set 1. A key sends its make code when pressed and make | 0x80 when released, the keys that
+    were added later (like PgUp/PgDn) send 0xE0 first.
+    Shift+PgUp/PgDn page through the screen's scrollback, any other key returns it to the live screen.
+*/
+
+namespace {
+    bool left_shift_down = false;
+    bool right_shift_down = false;
+    // The previous byte was 0xE0
+    bool extended = false;
+
+    void handleScanCode (uint8_t scan_code) {
+        if (scan_code == PS2Keyboard::ScanCodes::extended) {
+            extended = true;
+            return;
+        }
+        bool was_extended = extended;
+        extended = false;
+
+        bool released = scan_code & PS2Keyboard::ScanCodes::released;
+        uint8_t key = scan_code & ~PS2Keyboard::ScanCodes::released;
+
+        if (!was_extended && key == PS2Keyboard::ScanCodes::left_shift) {
+            left_shift_down = !released;
+            return;
+        }
+        if (!was_extended && key == PS2Keyboard::ScanCodes::right_shift) {
+            right_shift_down = !released;
+            return;
+        }
+        if (released) {
+            return;
+        }
+
+        bool shift = left_shift_down || right_shift_down;
+        // Keep one line of the previous page, to read on from
+        const int32_t page = FrameBuffer::rows - 1;
+        if (shift && was_extended && key == PS2Keyboard::ScanCodes::page_up) {
+            FrameBuffer::scrollView(page);
+        } else if (shift && was_extended && key == PS2Keyboard::ScanCodes::page_down) {
+            FrameBuffer::scrollView(-page);
+        } else if (FrameBuffer::isViewingHistory()) {
+            FrameBuffer::viewLive();
+        }
+    }
+}
+
+namespace {
+    // Filled by the interrupt handler, emptied by handleScanCodes, both on the CPU the IRQ goes to
+    const uint32_t scan_code_ring_size = 16;
+    const uint32_t scan_code_ring_mask = scan_code_ring_size - 1;
+    struct {
+        uint8_t data[scan_code_ring_size];
+        uint32_t head;
+        uint32_t tail;
+    } scan_code_ring;
+
+    void handleScanCodes (void*) {
+        uint32_t tail = scan_code_ring.tail;
+        while (tail != __atomic_load_n(&scan_code_ring.head, __ATOMIC_ACQUIRE)) {
+            uint8_t v = scan_code_ring.data[tail & scan_code_ring_mask];
+            __atomic_store_n(&scan_code_ring.tail, ++tail, __ATOMIC_RELEASE);
+
+            handleScanCode(v);
+            // This runs on top of whatever thread was interrupted, so it mustn't wait for the UART
+            char buffer[32];
+            size_t length = Format::format(buffer, sizeof(buffer), KFORMAT("Key Pressed/Released %03u\n"), v);
+            SerialPort::writeString(SerialPort::LOG, buffer, length, SerialPort::OverflowPolicy::Drop);
+        }
+    }
+
+    Deferred::Work scan_code_work = {handleScanCodes, 0, 0, 0};
+    IRQ::Handler keyboard_handler;
+}
+
 void PS2Keyboard::initialise () {
-    ISR::setInterruptHandler(33, PS2Keyboard::interruptHandler);
+    IRQ::addHandler(PS2Keyboard::irq, keyboard_handler, IRQ::HandlerFunction::fromFunction<PS2Keyboard::interruptHandler>(), "keyboard");
+    IRQ::unmask(PS2Keyboard::irq);
 }
 
 uint8_t PS2Keyboard::readScanCode () {
     return inbyte(PS2Keyboard::data_port);
 }
 
-void PS2Keyboard::interruptHandler (ISR::Registers, ISR::Interrupt int_number, ISR::StackState state) {
-    SerialPort::writeString(SerialPort::LOG, "Key Pressed/Released ", 21);
-
+bool PS2Keyboard::interruptHandler (ISR::Frame*) {
+    if (!(inbyte(PS2Keyboard::status_port) & PS2Keyboard::Status::outputFull)) {
+        return false;
+    }
     uint8_t v = PS2Keyboard::readScanCode();
 
-    // Acknowledge it
-    PIC::sendEOI(int_number);
-
-    SerialPort::writeDecimal<3, uint8_t>(SerialPort::LOG, v);
-    SerialPort::writeChar(SerialPort::LOG, '\n');
+    // Dropped if the ring is full, the work is still queued then
+    uint32_t head = scan_code_ring.head;
+    if (head - __atomic_load_n(&scan_code_ring.tail, __ATOMIC_ACQUIRE) != scan_code_ring_size) {
+        scan_code_ring.data[head & scan_code_ring_mask] = v;
+        __atomic_store_n(&scan_code_ring.head, head + 1, __ATOMIC_RELEASE);
+    }
+    // The rest (the scrollback and the serial log) runs with interrupts on
+    Deferred::queue(scan_code_work);
+    return true;
 }
\ No newline at end of file
@@ -0,0 +1,286 @@
+#include "irq.hpp"
+#include "acpi.hpp"
+#include "apic.hpp"
+#include "cpu.hpp"
+#include "general_assembly.hpp"
+#include "spinlock.hpp"
+
+namespace {
+    // The 8259s cascade the slave through this line of the master
+    const uint8_t cascade_irq = 2;
+
+    IRQ::Controller controller = IRQ::Controller::PIC;
+    uint32_t isa_gsi[IRQ::isa_irq_count];
+    uint8_t vectors[IRQ::isa_irq_count];
+
+    // The local APIC's priority class (the high nibble of the vector) of each IRQ, higher goes first. The
+    // PIT, then the serial ports, whose FIFOs overflow if they wait, then the RTC, then everything else.
+    // Class 8 is left alone for Benchmark::interruptDispatch's vector, class 15 is the local APIC's.
+    const uint8_t priorities[IRQ::isa_irq_count] = {
+        0xE, 0x5, 0x5, 0xD, 0xD, 0x5, 0x5, 0x5,
+        0xC, 0x5, 0x5, 0x5, 0x5, 0x5, 0x5, 0x5,
+    };
+
+    bool nesting = true;
+    bool nestable[IRQ::isa_irq_count] = {
+        true, true, true, true, true, true, true, true,
+        true, true, true, true, true, true, true, true,
+    };
+    // With the 8259s: the lines drivers have masked, and the lines blocked by the handlers running now.
+    // The IMRs hold both.
+    uint16_t pic_masked = 0xFFFF;
+    uint16_t pic_blocked = 0;
+    // The lines each IRQ blocks while its handlers run: itself and everything of no higher priority
+    uint16_t blocked_by[IRQ::isa_irq_count];
+
+    // With interrupts off
+    void writePICMask () {
+        uint16_t mask = pic_masked | pic_blocked;
+        outbyte(PIC::PIC1::data, mask & 0xFF);
+        outbyte(PIC::PIC2::data, mask >> 8);
+    }
+    // Static, the boot stack is small
+    ACPI::InterruptInfo info;
+
+    IRQ::Handler* chains[IRQ::isa_irq_count];
+    uint64_t unhandled[IRQ::isa_irq_count];
+    // Serialises addHandler and removeHandler, dispatch doesn't take it
+    Spinlock::Ticket chain_lock;
+
+    void dispatchChain (ISR::Frame* frame) {
+        // The low nibble of the vector, whichever controller it came from
+        uint8_t irq = frame->int_number & 0x0F;
+        CPU::Data* cpu = CPU::current();
+        // A locked add, so that it is visible before the chain is read. removeHandler unlinks and then
+        // reads this, in the opposite order.
+        __atomic_add_fetch(&cpu->irq_dispatch_depth, 1, __ATOMIC_SEQ_CST);
+
+        // The local APIC holds back everything of the same or a lower class until the EOI by itself. The
+        // 8259s' own priorities are fixed (the keyboard comes before the serial ports), so the lines to
+        // hold back are masked instead, and the EOI can go first.
+        bool nested = nesting && nestable[irq];
+        uint16_t previous_blocked = pic_blocked;
+        if (nested) {
+            // Whatever nests in here returns to it, rather than switching threads with the EOI not sent
+            cpu->preempt_disabled++;
+            if (controller == IRQ::Controller::PIC) {
+                pic_blocked |= blocked_by[irq];
+                writePICMask();
+                IRQ::endOfInterrupt(frame->int_number);
+            }
+            __asm__ volatile ("sti" : : : "memory");
+        }
+
+        bool handled = false;
+        for (IRQ::Handler* handler = __atomic_load_n(&chains[irq], __ATOMIC_ACQUIRE); handler;
+             handler = __atomic_load_n(&handler->next, __ATOMIC_ACQUIRE)) {
+            if (handler->func(frame)) {
+                handler->hits++;
+                handled = true;
+            }
+        }
+        if (!handled) {
+            unhandled[irq]++;
+        }
+
+        if (nested) {
+            __asm__ volatile ("cli" : : : "memory");
+            if (controller == IRQ::Controller::PIC) {
+                pic_blocked = previous_blocked;
+                writePICMask();
+            }
+            cpu->preempt_disabled--;
+        }
+
+        if (cpu->irq_dispatch_depth == 1) {
+            __atomic_store_n(&cpu->irq_dispatch_exits, cpu->irq_dispatch_exits + 1, __ATOMIC_RELEASE);
+        }
+        __atomic_store_n(&cpu->irq_dispatch_depth, cpu->irq_dispatch_depth - 1, __ATOMIC_RELEASE);
+        if (!nested || controller == IRQ::Controller::APIC) {
+            IRQ::endOfInterrupt(frame->int_number);
+        }
+    }
+
+    // Waits until every CPU that may have been in dispatchChain when this was called has left it
+    void waitForDispatchers () {
+        for (uint32_t i = 0; i < CPU::max_cpus; i++) {
+            CPU::Data& cpu = CPU::get(i);
+            if (!cpu.online || __atomic_load_n(&cpu.irq_dispatch_depth, __ATOMIC_SEQ_CST) == 0) {
+                continue;
+            }
+            uint32_t exits = __atomic_load_n(&cpu.irq_dispatch_exits, __ATOMIC_ACQUIRE);
+            while (__atomic_load_n(&cpu.irq_dispatch_depth, __ATOMIC_ACQUIRE) != 0 &&
+                   __atomic_load_n(&cpu.irq_dispatch_exits, __ATOMIC_ACQUIRE) == exits) {
+                __asm__ volatile ("pause");
+            }
+        }
+    }
+
+    // Spurious interrupts aren't in service, so they get no EOI
+    void spuriousHandler (ISR::Frame*) {}
+
+    uint32_t getRedirectionFlags (uint16_t interrupt_flags) {
+        uint32_t flags = IOAPIC::Redirection::masked;
+        if ((interrupt_flags & ACPI::MADT::InterruptFlags::polarityMask) == ACPI::MADT::InterruptFlags::activeLow) {
+            flags |= IOAPIC::Redirection::activeLow;
+        }
+        if ((interrupt_flags & ACPI::MADT::InterruptFlags::triggerMask) == ACPI::MADT::InterruptFlags::levelTriggered) {
+            flags |= IOAPIC::Redirection::levelTriggered;
+        }
+        return flags;
+    }
+
+    bool initialiseAPIC () {
+        if (!LocalAPIC::isSupported() || !ACPI::initialise() || !ACPI::readInterruptInfo(info)) {
+            return false;
+        }
+        if (!LocalAPIC::initialise(info.local_apic_address, info.nmi_lint, info.nmi_flags)) {
+            return false;
+        }
+        for (uint32_t i = 0; i < info.io_apic_count; i++) {
+            IOAPIC::add(info.io_apic_addresses[i], info.io_apic_gsi_bases[i]);
+        }
+
+        // Everything goes to this CPU
+        uint8_t destination = LocalAPIC::getID();
+        for (uint8_t irq = 0; irq < IRQ::isa_irq_count; irq++) {
+            vectors[irq] = (priorities[irq] << 4) | irq;
+            isa_gsi[irq] = info.isa_gsi[irq];
+            if (irq != cascade_irq) {
+                IOAPIC::setRedirection(isa_gsi[irq], IRQ::getVector(irq), destination, getRedirectionFlags(info.isa_flags[irq]));
+            }
+        }
+        ISR::setIRQHandler(LocalAPIC::spurious_vector, spuriousHandler);
+        return true;
+    }
+}
+
+void IRQ::initialise () {
+    // Even with the APIC, so that anything the 8259s still raise lands on harmless vectors
+    PIC::remapPIC();
+    writePICMask();
+
+    for (uint8_t irq = 0; irq < isa_irq_count; irq++) {
+        vectors[irq] = PIC::PIC1::start_interrupt + irq;
+        blocked_by[irq] = 0;
+        for (uint8_t other = 0; other < isa_irq_count; other++) {
+            // The cascade stays open for the slave's lines that aren't blocked
+            if (other != cascade_irq && priorities[other] <= priorities[irq]) {
+                blocked_by[irq] |= 1 << other;
+            }
+        }
+    }
+
+    if (initialiseAPIC()) {
+        controller = Controller::APIC;
+    }
+    Spinlock::addStats(chain_lock.stats, "irq chains");
+}
+
+IRQ::Controller IRQ::getController () {
+    return controller;
+}
+
+const ACPI::InterruptInfo* IRQ::getInterruptInfo () {
+    return controller == Controller::APIC ? &info : 0;
+}
+
+uint8_t IRQ::getVector (uint8_t irq) {
+    return vectors[irq];
+}
+
+void IRQ::mask (uint8_t irq) {
+    if (controller == Controller::APIC) {
+        IOAPIC::mask(isa_gsi[irq]);
+    } else {
+        uint32_t flags = saveAndDisableInterrupts();
+        pic_masked |= 1 << irq;
+        writePICMask();
+        restoreInterrupts(flags);
+    }
+}
+
+void IRQ::unmask (uint8_t irq) {
+    if (controller == Controller::APIC) {
+        IOAPIC::unmask(isa_gsi[irq]);
+    } else {
+        uint32_t flags = saveAndDisableInterrupts();
+        pic_masked &= ~(1 << irq);
+        if (irq >= 8) {
+            pic_masked &= ~(1 << cascade_irq);
+        }
+        writePICMask();
+        restoreInterrupts(flags);
+    }
+}
+
+void IRQ::setNesting (bool enabled) {
+    nesting = enabled;
+}
+
+void IRQ::setNestable (uint8_t irq, bool enabled) {
+    if (irq < isa_irq_count) {
+        nestable[irq] = enabled;
+    }
+}
+
+void IRQ::endOfInterrupt (ISR::Interrupt vector) {
+    if (controller == Controller::APIC) {
+        LocalAPIC::sendEOI();
+    } else {
+        PIC::sendEOI(vector);
+    }
+}
+
+bool IRQ::addHandler (uint8_t irq, IRQ::Handler& handler, IRQ::HandlerFunction func, const char* name) {
+    if (irq >= isa_irq_count) {
+        return false;
+    }
+    handler.func = func;
+    handler.name = name;
+    handler.hits = 0;
+    handler.next = 0;
+
+    uint32_t flags = Spinlock::lockIRQSave(chain_lock);
+    Handler** link = &chains[irq];
+    bool added = true;
+    if (!*link) {
+        // The first one, unless the vector is taken. Once set, dispatchChain stays even if the chain empties.
+        ISR::IRQHandler current = ISR::irq_handlers[getVector(irq)];
+        added = current == dispatchChain || ISR::setIRQHandler(getVector(irq), dispatchChain);
+    }
+    if (added) {
+        while (*link) {
+            link = &(*link)->next;
+        }
+        // Published with everything above visible first
+        __atomic_store_n(link, &handler, __ATOMIC_RELEASE);
+    }
+    Spinlock::unlockIRQRestore(chain_lock, flags);
+    return added;
+}
+
+void IRQ::removeHandler (uint8_t irq, IRQ::Handler& handler) {
+    if (irq >= isa_irq_count) {
+        return;
+    }
+    uint32_t flags = Spinlock::lockIRQSave(chain_lock);
+    for (Handler** link = &chains[irq]; *link; link = &(*link)->next) {
+        if (*link == &handler) {
+            // handler->next stays as it is, for whoever is on handler right now
+            __atomic_store_n(link, handler.next, __ATOMIC_SEQ_CST);
+            break;
+        }
+    }
+    Spinlock::unlockIRQRestore(chain_lock, flags);
+
+    waitForDispatchers();
+}
+
+const IRQ::Handler* IRQ::getHandlers (uint8_t irq) {
+    return irq < isa_irq_count ? __atomic_load_n(&chains[irq], __ATOMIC_ACQUIRE) : 0;
+}
+
+uint64_t IRQ::getUnhandledCount (uint8_t irq) {
+    return irq < isa_irq_count ? unhandled[irq] : 0;
+}
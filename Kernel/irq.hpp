@@ -0,0 +1,101 @@
+#ifndef INCLUDE_IRQ_H
+#define INCLUDE_IRQ_H
+
+#include "../Include/stdint.h"
+#include "acpi.hpp"
+#include "io.hpp"
+#include "isr.hpp"
+#include "delegate.hpp"
+
+/* IRQ:
+    Device interrupts, whichever controller delivers them. With a local APIC and an I/O APIC described by
+    the ACPI MADT, the 8259s are masked for good and the ISA IRQs are routed through I/O APIC redirection
+    entries (following the MADT's overrides, e.g. the PIT is usually on GSI 2). Otherwise the 8259s are used.
+    Drivers register their handlers on getVector(irq), and acknowledge with endOfInterrupt: a single store to
+    the local APIC's EOI register, or the 8259 port writes. ISA IRQ n arrives on vector
+    PIC::PIC1::start_interrupt + n from the 8259s, and on (priority << 4) | n from the I/O APIC, so either
+    way n is the low nibble of the vector.
+    Every line starts out masked, drivers unmask theirs once their handler is in place.
+
+    Shared IRQs:
+    Drivers whose line may be shared (PCI, or anything behind the cascade) add a Handler to the IRQ's chain
+    instead of setting the vector's handler themselves. Every handler in the chain is called and says
+    whether its device raised the interrupt, then the chain acknowledges it once. Handlers don't call
+    endOfInterrupt.
+
+    Nesting:
+    Chains run with interrupts enabled, so a slow handler doesn't hold up the IRQs that come before it. Each
+    IRQ has a fixed priority (see priorities in irq.cpp: the PIT, then the serial ports, then the RTC, then
+    the rest), and while its chain runs, only IRQs of a higher priority get in. With the APIC, the priority
+    is the vector's class, and the local APIC holds the others back until the EOI. With the 8259s, whose own
+    order can't be changed, the others are masked in the IMRs while it runs. Preemption is disabled while a
+    chain runs, and bottom halves (see Deferred) wait for the outermost interrupt.
+    setNestable(irq, false) keeps interrupts disabled while that IRQ's chain runs, for handlers that can't
+    take being interrupted. The vectors with a handler of their own (like the PIT's) always run with
+    interrupts disabled.
+    Dispatch takes no lock: handlers are published with a release store of the pointer that links them in,
+    so a CPU walking the chain sees either all of a new handler or none of it. removeHandler unlinks a
+    handler and then waits for a grace period, until every CPU that was dispatching when it was unlinked
+    has finished, after which nothing can still be using it. Each CPU counts how deep it is in dispatch and
+    how often it has left it, in its CPU::Data, and the remover only reads those.
+*/
+namespace IRQ {
+    enum class Controller : uint8_t {
+        PIC,
+        APIC,
+    };
+
+    static const uint8_t isa_irq_count = 16;
+
+    // Needs the IDT
+    void initialise ();
+    Controller getController ();
+    // What the MADT says about the machine, null if the 8259s are used
+    const ACPI::InterruptInfo* getInterruptInfo ();
+
+    // Set by initialise, for the controller in use
+    uint8_t getVector (uint8_t irq);
+
+    void mask (uint8_t irq);
+    void unmask (uint8_t irq);
+
+    // Acknowledges the interrupt on `vector`, handlers call it once they have dealt with the device
+    void endOfInterrupt (ISR::Interrupt vector);
+
+    // Whether chains run with interrupts enabled at all, on by default
+    void setNesting (bool enabled);
+    // Whether the IRQ's chain runs with interrupts enabled, on by default
+    void setNestable (uint8_t irq, bool enabled);
+
+    // @return Whether its device raised the interrupt
+    using HandlerFunction = Delegate<bool(ISR::Frame* frame)>;
+
+    // Owned by the driver, and must stay where it is until removeHandler returns. Everything has an
+    // initialiser, so that static Handlers are constant initialised.
+    struct Handler {
+        HandlerFunction func;
+        const char* name = 0;
+        // Interrupts its device raised. Only the CPU the IRQ is sent to counts them.
+        uint64_t hits = 0;
+        Handler* next = 0;
+    };
+
+    /** addHandler:
+     * Sets the handler up and adds it to the end of the IRQ's chain. May be called while the IRQ is
+     * unmasked and being dispatched on another CPU. Doesn't unmask it.
+     *
+     * @param name Must outlive the handler
+     * @return false if the IRQ's vector has a handler of its own, from ISR::setIRQHandler
+     */
+    bool addHandler (uint8_t irq, Handler& handler, HandlerFunction func, const char* name);
+
+    // Unlinks the handler and waits until no CPU can still be running it. Not from an interrupt handler.
+    void removeHandler (uint8_t irq, Handler& handler);
+
+    // The first handler in the chain, for listing them, null if there are none
+    const Handler* getHandlers (uint8_t irq);
+    // Interrupts on the IRQ that no handler in its chain claimed
+    uint64_t getUnhandledCount (uint8_t irq);
+};
+
+#endif
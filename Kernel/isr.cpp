@@ -1,33 +1,88 @@
 #include "isr.hpp"
 #include "io.hpp"
-#include "../Include/kcstring.hpp"
+#include "format.hpp"
+#include "descriptor_tables.hpp"
+#include "spinlock.hpp"
 
-Function<void(ISR::Registers, ISR::Interrupt, ISR::StackState)> ISR::interrupt_handlers[ISR::interrupt_handler_count];
+ISR::InterruptHandlerFunction ISR::interrupt_handlers[ISR::interrupt_handler_count];
+
+ISR::IRQHandler ISR::irq_handlers[ISR::interrupt_handler_count];
 
 void initialiseInterrupts () {}
 
+namespace {
+    // Serialises the setters of both tables
+    Spinlock::Ticket handlers_lock;
+
+    // For the vectors nobody has given a fast handler
+    void dispatchSlow (ISR::Frame* frame) {
+        ISR::Registers regs;
+        // The irq stubs don't save it, and it is only ever the kernel's
+        regs.ds = GDT::Selectors::kernel_data;
+        regs.edi = frame->edi;
+        regs.esi = frame->esi;
+        regs.ebp = frame->ebp;
+        regs.esp = frame->esp;
+        regs.ebx = frame->ebx;
+        regs.edx = frame->edx;
+        regs.ecx = frame->ecx;
+        regs.eax = frame->eax;
+
+        ISR::StackState state;
+        state.error_code = frame->error_code;
+        state.eip = frame->eip;
+        state.cs = frame->cs;
+        state.eflags = frame->eflags;
+
+        ISR::isr_handler(regs, frame->int_number, state);
+    }
+}
+
+void ISR::initialiseIRQHandlers () {
+    for (uint32_t i = 0; i < interrupt_handler_count; i++) {
+        irq_handlers[i] = dispatchSlow;
+    }
+    Spinlock::addStats(handlers_lock.stats, "interrupt handlers");
+}
+
+bool ISR::setInterruptHandler (uint32_t int_number, const ISR::InterruptHandlerFunction& handler, bool force) {
+    if (int_number >= interrupt_handler_count) {
+        return false;
+    }
+    bool set = false;
+    uint32_t flags = Spinlock::lockIRQSave(handlers_lock);
+    if (force || !interrupt_handlers[int_number].hasFunction()) {
+        interrupt_handlers[int_number] = handler;
+        set = true;
+    }
+    Spinlock::unlockIRQRestore(handlers_lock, flags);
+    return set;
+}
+
+bool ISR::setIRQHandler (uint32_t int_number, ISR::IRQHandler handler, bool force) {
+    if (int_number < first_irq_vector || int_number >= interrupt_handler_count) {
+        return false;
+    }
+    bool set = false;
+    uint32_t flags = Spinlock::lockIRQSave(handlers_lock);
+    if (force || irq_handlers[int_number] == dispatchSlow) {
+        // One aligned store, so a CPU taking the interrupt right now calls either the old or the new one
+        __atomic_store_n(&irq_handlers[int_number], handler, __ATOMIC_RELEASE);
+        set = true;
+    }
+    Spinlock::unlockIRQRestore(handlers_lock, flags);
+    return set;
+}
+
 extern "C" void ISR::isr_handler (ISR::Registers regs, ISR::Interrupt int_number, ISR::StackState state) {
     if (int_number < ISR::interrupt_handler_count && ISR::interrupt_handlers[int_number].hasFunction()) {
         interrupt_handlers[int_number](regs, int_number, state);
         return;
     }
 
-    const char* text = "Unhandled INT ";
-
-    SerialPort::writeString(SerialPort::LOG, text, KCString::getLength(text));
-    FrameBuffer::writeString(text, KCString::getLength(text), 2, 4);
-
-    char num_text[3] = {0, 0, 0};
-    uint8_t num = int_number;
-
-    num_text[2] = (num % 10) + 48;
-    num_text[1] = ((num % 100) / 10) + 48;
-    num_text[0] = ((num % 1000) / 100) + 48;
+    char text[32];
+    size_t length = Format::format(text, sizeof(text), KFORMAT("Unhandled INT %03u\n"), int_number);
 
-    FrameBuffer::writeCell(num_text[0], 2, 4);
-    FrameBuffer::writeCell(num_text[1], 2, 4);
-    FrameBuffer::writeCell(num_text[2], 2, 4);
-    SerialPort::writeDecimal<3, ISR::Interrupt>(SerialPort::LOG, num);
-    FrameBuffer::writeCell('\n', 2, 4);
-    SerialPort::writeChar(SerialPort::LOG, '\n');
+    SerialPort::writeString(SerialPort::LOG, text, length);
+    FrameBuffer::writeString(text, length, 2, 4);
 }
\ No newline at end of file
@@ -2,7 +2,7 @@
 #define INCLUDE_ISR_H
 
 #include "../Include/stdint.h"
-#include "function.hpp"
+#include "delegate.hpp"
 
 namespace ISR {
     using Interrupt = uint32_t;
@@ -32,6 +32,23 @@ namespace ISR {
 
     extern "C" void isr_handler (Registers regs, ISR::Interrupt int_number, StackState state);
 
+    // What the irqN stubs save, in the order it is on the stack
+    struct Frame {
+        Register32 edi;
+        Register32 esi;
+        Register32 ebp;
+        Register32 esp;
+        Register32 ebx;
+        Register32 edx;
+        Register32 ecx;
+        Register32 eax;
+        ISR::Interrupt int_number;
+        uint32_t error_code;
+        Register32 eip;
+        SegmentRegister32 cs;
+        EFlagsRegister32 eflags;
+    } __attribute__((packed));
+
     static inline bool areInterruptsEnabled () {
         unsigned long flags;
         __asm__ volatile ("pushf\n\tpop %0" : "=g"(flags));
@@ -41,18 +58,55 @@ namespace ISR {
     void initialiseInterrupts ();
 
     const static uint32_t interrupt_handler_count = 256;
-    using InterruptHandlerFunction = Function<void(Registers, ISR::Interrupt, StackState)>;
+    // A Delegate, so a handler can be a driver object's member function or a lambda with its state
+    using InterruptHandlerFunction = Delegate<void(Registers, ISR::Interrupt, StackState)>;
     extern InterruptHandlerFunction interrupt_handlers[interrupt_handler_count];
 
+    /** setInterruptHandler:
+     * Setters take a lock, dispatch doesn't, so the vector mustn't be raised while its handler is changed.
+     *
+     * @param force Replace a handler that is already there
+     * @return false if there was one already, and force wasn't given
+     */
+    bool setInterruptHandler (uint32_t int_number, const InterruptHandlerFunction& handler, bool force=false);
+
+    // For plain functions known at compile time, dispatch is then a single indirect call:
+    //     ISR::setInterruptHandler<pageFaultHandler>(14);
+    template<void (*func) (Registers, Interrupt, StackState)>
+    bool setInterruptHandler (uint32_t int_number, bool force=false) {
+        return setInterruptHandler(int_number, InterruptHandlerFunction::fromFunction<func>(), force);
+    }
+
+    // For function pointers only known at run time, which cost a second indirect call
     template<typename T>
     bool setInterruptHandler (uint32_t int_number, T func, bool force=false) {
-        if (force || !interrupt_handlers[int_number].hasFunction()) {
-            interrupt_handlers[int_number] = func;
-            return true;
-        }
-        return false;
+        return setInterruptHandler(int_number, InterruptHandlerFunction(func), force);
     }
 
+    /* IRQ fast path:
+        Vectors 32-255 (the device interrupts, IPIs, and anything software raises there) enter through the
+        irqN stubs in interrupt.s rather than isr_common_stub. They save the registers, don't touch the
+        segment registers unless the interrupt came from user mode, and call irq_handlers[vector] directly
+        with a pointer to the saved Frame.
+        Vectors without an IRQ handler go on to isr_handler and interrupt_handlers, so setInterruptHandler
+        still works for them, at the old cost.
+    */
+    static const uint32_t first_irq_vector = 32;
+    using IRQHandler = void (*) (Frame* frame);
+    extern "C" IRQHandler irq_handlers[interrupt_handler_count];
+    // The addresses of the irqN stubs, from first_irq_vector on
+    extern "C" const uint32_t irq_stub_table[interrupt_handler_count - first_irq_vector];
+
+    // Fills irq_handlers in, before the IDT is loaded
+    void initialiseIRQHandlers ();
+
+    /** setIRQHandler:
+     * @param int_number At least first_irq_vector
+     * @param force Replace a handler that is already there
+     * @return false if there was one already, and force wasn't given
+     */
+    bool setIRQHandler (uint32_t int_number, IRQHandler handler, bool force=false);
+
 
     // Start interrupt functions
     extern "C" void isr0();
@@ -1,8 +1,21 @@
 #include "io.hpp"
+#include "format.hpp"
 #include "general_assembly.hpp"
 #include "descriptor_tables.hpp"
 #include "../Include/kcstring.hpp"
 #include "isr.hpp"
+#include "multiboot.hpp"
+#include "frame_allocator.hpp"
+#include "heap.hpp"
+#include "paging.hpp"
+#include "benchmark.hpp"
+#include "console.hpp"
+#include "timer.hpp"
+#include "clock.hpp"
+#include "irq.hpp"
+#include "cpu.hpp"
+#include "smp.hpp"
+#include "thread.hpp"
 /* To remind myself how the stack is structured until I retain the knowledge:
 struct Alpha {
     uint32_t a;
@@ -30,20 +43,24 @@ test_func:
 
 */
 
-extern "C" void kmain (uint32_t stack_position, uint32_t stack_size) {
+extern "C" void kmain (uint32_t stack_position, uint32_t stack_size, uint32_t multiboot_magic, uint32_t multiboot_info) {
     init_descriptor_tables();
+    // Before anything can use the per-CPU area, interrupt handlers included
+    CPU::initialise(0, 0, stack_position + stack_size);
 
     // Enable interrupts again
     __asm__ volatile ("sti");
 
-    // Remap the PIC interrupts to the correct places.
-    PIC::remapPIC();
-    outbyte(PIC::PIC1::data, 0b11111101);
-    outbyte(PIC::PIC2::data, 0b11111111);
+    // Local APIC and I/O APIC if the MADT describes them, the remapped 8259s otherwise. Every line starts
+    // out masked, the drivers below unmask their own.
+    IRQ::initialise();
 
+    FrameBuffer::initialise();
     FrameBuffer::setCursorPosition(0, 0);
 
     PS2Keyboard::initialise();
+    Clock::initialise();
+    Timer::initialise();
 
 
     char* alpha = "Starting up";
@@ -55,16 +72,36 @@ extern "C" void kmain (uint32_t stack_position, uint32_t stack_size) {
         FrameBuffer::writeCell('0', 3, 8);
     }
 
-    SerialPort::configureBaudRate(SerialPort::LOG, 0x0006);
-    SerialPort::configureLine(SerialPort::LOG);
+    // 115200 baud, the fastest the UART goes
+    SerialPort::initialise(SerialPort::LOG, 1);
     SerialPort::writeString(SerialPort::LOG, alpha, 6);
 
-    SerialPort::writeChar(SerialPort::LOG, '\n');
-    SerialPort::writeDecimal<10, uint32_t>(SerialPort::LOG, stack_position);
-    SerialPort::writeChar(SerialPort::LOG, '-');
-    SerialPort::writeDecimal<10, uint32_t>(SerialPort::LOG, stack_size);
-    SerialPort::writeChar(SerialPort::LOG, '\n');
+    kprintf(SerialPort::LOG, "\nstack %p-%p\n", (void*)stack_position, (void*)(stack_position + stack_size));
+    kprintf(SerialPort::LOG, "Interrupts through the %s\n", IRQ::getController() == IRQ::Controller::APIC ? "I/O APIC" : "8259 PIC");
+    kprintf(SerialPort::LOG, "TSC %u kHz, invariant %u\n", (uint32_t)divide64(Clock::getTSCFrequency(), 1000), (uint32_t)Clock::hasInvariantTSC());
+
+    if (multiboot_magic == Multiboot::bootloader_magic) {
+        // The multiboot structures are in the first MiB, which the loader has already mapped
+        FrameAllocator::init((const Multiboot::Info*)Memory::physicalToVirtual(multiboot_info));
+        Paging::init(FrameAllocator::getMemoryEnd());
+        Heap::init();
+        // kmain carries on as the main thread
+        Thread::initialise();
+
+        kprintf(SerialPort::LOG, "Frames free/total: %u/%u\n", FrameAllocator::getFreeFrameCount(), FrameAllocator::getTotalFrameCount());
+    } else {
+        kprintf(SerialPort::LOG, "Not booted by multiboot (magic %08x), no memory map\n", multiboot_magic);
+    }
+
+    kprintf(SerialPort::LOG, "CPUs online: %u\n", SMP::initialise());
+
+#ifdef KERNEL_BENCHMARKS
+    Benchmark::runAll();
+#endif
 
     __asm__ volatile ("int $0x3");
     __asm__ volatile ("int $0x4");
+
+    Console::initialise(SerialPort::LOG);
+    Console::run();
 }
\ No newline at end of file
@@ -1,28 +1,96 @@
-global loader                   ; the entry symbol for ELF
+global loader                   ; the entry symbol for ELF (see link.ld, GRUB jumps to its physical address)
 
 MAGIC_NUMBER equ 0x1BADB002     ; define the magic number constant
-FLAGS        equ 0x0            ; multiboot flags
-CHECKSUM     equ -MAGIC_NUMBER  ; calculate the checksum
+ALIGN_MODULES equ 1 << 0        ; load modules on page boundaries
+MEMORY_INFO  equ 1 << 1         ; ask for mem_* and the memory map in the multiboot info
+FLAGS        equ ALIGN_MODULES | MEMORY_INFO ; multiboot flags
+CHECKSUM     equ -(MAGIC_NUMBER + FLAGS) ; calculate the checksum
                                     ; (magic number + checksum + flags should equal 0)
 KERNEL_STACK_SIZE equ 4096      ; size of stack in bytes
 
+KERNEL_VIRTUAL_BASE equ 0xC0000000 ; must match link.ld and Memory::kernel_virtual_base
+KERNEL_PDE_INDEX equ KERNEL_VIRTUAL_BASE >> 22 ; page directory entry that maps KERNEL_VIRTUAL_BASE
+LARGE_PAGE_FLAGS equ 0x83       ; present, writable, 4 MiB page (PSE)
+CR4_PSE      equ 1 << 4
+CR0_PG       equ 1 << 31
+
 section .bss
 align 4
 kernel_stack:
     resb KERNEL_STACK_SIZE ; reserve stack for the kerne
 
-section .text                   ; start of the text (code) section
-align 4                         ; the code must be 4 byte aligned
+section .data
+; The page directory used from boot onwards. Filled in by the loader before paging is turned on,
+; and later extended by Paging::init. Every entry is a 4 MiB page, so there are no page tables.
+align 4096
+global boot_page_directory
+boot_page_directory:
+    times 1024 dd 0
+
+section .multiboot               ; placed first in the image by link.ld
+align 4                         ; the header must be 4 byte aligned
     dd MAGIC_NUMBER             ; write the magic number to the machine code,
     dd FLAGS                    ; the flags,
     dd CHECKSUM                 ; and the checksum
 
-loader:                         ; the loader label (defined as entry point in linker script)
+section .text                   ; start of the text (code) section
+align 4
+
+; Runs at its physical address with paging off, so every symbol has to be translated by hand
+; until we have jumped to higher_half. eax and ebx hold the multiboot magic and info and must survive.
+loader:
+    ; Number of 4 MiB pages needed to cover the kernel image
+    extern kernel_physical_end
+    mov ecx, kernel_physical_end
+    add ecx, 0x3FFFFF
+    shr ecx, 22
+
+    ; Map them both at 0 (identity, needed until we jump up) and at KERNEL_VIRTUAL_BASE
+    mov edi, boot_page_directory - KERNEL_VIRTUAL_BASE
+    mov edx, LARGE_PAGE_FLAGS
+    xor esi, esi
+.map:
+    mov [edi + esi * 4], edx
+    mov [edi + esi * 4 + KERNEL_PDE_INDEX * 4], edx
+    add edx, 0x400000
+    inc esi
+    cmp esi, ecx
+    jb .map
+
+    mov edx, cr4
+    or edx, CR4_PSE
+    mov cr4, edx
+
+    mov cr3, edi
+
+    mov edx, cr0
+    or edx, CR0_PG
+    mov cr0, edx
+
+    ; Absolute jump, eip is still the physical address until now
+    lea edx, [higher_half]
+    jmp edx
+
+higher_half:
+    ; Remove the identity map, nothing below KERNEL_VIRTUAL_BASE is used anymore
+    xor esi, esi
+.unmap:
+    mov dword [boot_page_directory + esi * 4], 0
+    inc esi
+    cmp esi, ecx
+    jb .unmap
+    mov edx, cr3                ; reloading cr3 flushes the stale identity entries from the TLB
+    mov cr3, edx
+
     mov esp, kernel_stack + KERNEL_STACK_SIZE ; point esp to the start of the stack (end of mem area)
 
+    ; GRUB leaves the multiboot magic in eax and the physical address of the multiboot info in ebx
+    push ebx
+    push eax
     push KERNEL_STACK_SIZE
     push kernel_stack
     extern kmain ; see kmain.c
     call kmain
 .loop:
-    jmp .loop                   ; loop forever
\ No newline at end of file
+    hlt                         ; sleep until an interrupt, instead of spinning
+    jmp .loop                   ; loop forever
@@ -1,7 +1,117 @@
 #include "memory.hpp"
 
+/* Memory primitives:
+    All of them work in three parts: single bytes until the destination is 4-byte aligned (the head),
+    `rep stosd`/`rep movsd` for the aligned middle (the body), then the remaining 0-3 bytes (the tail).
+    Short operations skip straight to bytes, since setting up a string instruction costs more than it saves.
+    The loops are written in assembly on purpose: the compiler likes to turn a plain byte loop into a call
+    to memset/memcpy, which would end up calling itself.
+*/
+
+namespace {
+    // Below this many bytes everything is done with `rep movsb`/`rep stosb`
+    const size_t small_size = 16;
+
+    using AliasedWord = uint32_t __attribute__((may_alias));
+
+    size_t getHeadSize (const void* ptr, size_t size) {
+        size_t head = (4 - ((uint32_t)ptr & 3)) & 3;
+        return head < size ? head : size;
+    }
+}
+
 void Memory::memset (void* ptr, uint8_t v, size_t size)  {
+    uint8_t* dest = (uint8_t*)ptr;
+    if (size >= small_size) {
+        size_t head = getHeadSize(dest, size);
+        size -= head;
+        __asm__ volatile ("rep stosb" : "+D"(dest), "+c"(head) : "a"(v) : "memory");
+
+        size_t words = size / 4;
+        size &= 3;
+        __asm__ volatile ("rep stosl" : "+D"(dest), "+c"(words) : "a"(v * 0x01010101u) : "memory");
+    }
+    __asm__ volatile ("rep stosb" : "+D"(dest), "+c"(size) : "a"(v) : "memory");
+}
+
+void Memory::memcpy (void* destination, const void* source, size_t size) {
+    uint8_t* dest = (uint8_t*)destination;
+    const uint8_t* src = (const uint8_t*)source;
+    if (size >= small_size) {
+        // Aligning the destination is what matters, a misaligned source only costs a little on x86
+        size_t head = getHeadSize(dest, size);
+        size -= head;
+        __asm__ volatile ("rep movsb" : "+D"(dest), "+S"(src), "+c"(head) : : "memory");
+
+        size_t words = size / 4;
+        size &= 3;
+        __asm__ volatile ("rep movsl" : "+D"(dest), "+S"(src), "+c"(words) : : "memory");
+    }
+    __asm__ volatile ("rep movsb" : "+D"(dest), "+S"(src), "+c"(size) : : "memory");
+}
+
+void Memory::memmove (void* destination, const void* source, size_t size) {
+    uint8_t* dest = (uint8_t*)destination;
+    const uint8_t* src = (const uint8_t*)source;
+    if (dest <= src || dest >= src + size) {
+        // Copying forwards never overwrites source bytes that haven't been read yet
+        Memory::memcpy(destination, source, size);
+        return;
+    }
+
+    // The destination overlaps the end of the source, so copy backwards with the direction flag set.
+    // The string instructions then start at the last element and move down. The interrupt stubs clear DF
+    // for their handlers, and iret sets it again.
+    dest += size;
+    src += size;
+    size_t head = size >= small_size ? ((uint32_t)dest & 3) : size;
+    size -= head;
+    uint8_t* last_dest = dest - 1;
+    const uint8_t* last_src = src - 1;
+    __asm__ volatile ("std\n\trep movsb\n\tcld" : "+D"(last_dest), "+S"(last_src), "+c"(head) : : "memory");
+
+    size_t words = size / 4;
+    size &= 3;
+    uint8_t* word_dest = last_dest - 3;
+    const uint8_t* word_src = last_src - 3;
+    __asm__ volatile ("std\n\trep movsl\n\tcld" : "+D"(word_dest), "+S"(word_src), "+c"(words) : : "memory");
+
+    last_dest = word_dest + 3;
+    last_src = word_src + 3;
+    __asm__ volatile ("std\n\trep movsb\n\tcld" : "+D"(last_dest), "+S"(last_src), "+c"(size) : : "memory");
+}
+
+int Memory::memcmp (const void* first, const void* second, size_t size) {
+    const uint8_t* a = (const uint8_t*)first;
+    const uint8_t* b = (const uint8_t*)second;
+
+    // Skip over equal words, then find the differing byte
+    while (size >= 4 && *(const AliasedWord*)a == *(const AliasedWord*)b) {
+        a += 4;
+        b += 4;
+        size -= 4;
+    }
     for (size_t i = 0; i < size; i++) {
-        *(((char*)ptr)+i) = v;
+        if (a[i] != b[i]) {
+            return (int)a[i] - (int)b[i];
+        }
     }
-}
\ No newline at end of file
+    return 0;
+}
+
+// The compiler may emit calls to these itself (struct copies, zeroing), even with -ffreestanding
+extern "C" void* memset (void* ptr, int v, size_t size) {
+    Memory::memset(ptr, (uint8_t)v, size);
+    return ptr;
+}
+extern "C" void* memcpy (void* destination, const void* source, size_t size) {
+    Memory::memcpy(destination, source, size);
+    return destination;
+}
+extern "C" void* memmove (void* destination, const void* source, size_t size) {
+    Memory::memmove(destination, source, size);
+    return destination;
+}
+extern "C" int memcmp (const void* first, const void* second, size_t size) {
+    return Memory::memcmp(first, second, size);
+}
@@ -5,6 +5,26 @@
 
 namespace Memory {
     void memset (void* ptr, uint8_t v, size_t size);
+    // The regions must not overlap
+    void memcpy (void* destination, const void* source, size_t size);
+    // The regions may overlap
+    void memmove (void* destination, const void* source, size_t size);
+    // < 0, 0 or > 0 when the first differing byte is smaller in `first`, there is none, or it is larger
+    int memcmp (const void* first, const void* second, size_t size);
+
+    // The kernel lives in the higher half. Physical memory below direct_map_limit is mapped
+    // at kernel_virtual_base + physical address (see paging.hpp).
+    static const uint32_t kernel_virtual_base = 0xC0000000;
+    static const uint32_t direct_map_limit = 0x30000000;
+
+    // Only valid for physical addresses below direct_map_limit
+    inline void* physicalToVirtual (uint32_t physical_address) {
+        return (void*)(physical_address + kernel_virtual_base);
+    }
+    // Only valid for addresses in the direct map (which includes the kernel image)
+    inline uint32_t virtualToPhysical (const void* address) {
+        return (uint32_t)address - kernel_virtual_base;
+    }
 };
 
-#endif
\ No newline at end of file
+#endif
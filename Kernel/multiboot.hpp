@@ -0,0 +1,65 @@
+#ifndef INCLUDE_MULTIBOOT_H
+#define INCLUDE_MULTIBOOT_H
+
+#include "../Include/stdint.h"
+
+/* Multiboot (version 1):
+    GRUB leaves the magic value in eax and the physical address of the information structure in ebx
+    when it jumps to the loader. loader.s passes both along to kmain.
+    Which fields of the information structure are valid is described by the bits in `flags`.
+    See: https://www.gnu.org/software/grub/manual/multiboot/multiboot.html
+*/
+namespace Multiboot {
+    // What the bootloader leaves in eax
+    static const uint32_t bootloader_magic = 0x2BADB002;
+
+    struct Flags {
+        // mem_lower and mem_upper are valid
+        static const uint32_t Memory = 0x001;
+        // mods_count and mods_address are valid
+        static const uint32_t Modules = 0x008;
+        // mmap_length and mmap_address are valid
+        static const uint32_t MemoryMap = 0x040;
+    };
+
+    struct Info {
+        uint32_t flags;
+        // Amount of lower memory in KiB (starting at 0)
+        uint32_t mem_lower;
+        // Amount of upper memory in KiB (starting at 1 MiB)
+        uint32_t mem_upper;
+        uint32_t boot_device;
+        uint32_t cmdline;
+        uint32_t mods_count;
+        // Physical address of the first of mods_count Modules
+        uint32_t mods_address;
+        uint32_t syms[4];
+        // Size in bytes of the memory map buffer
+        uint32_t mmap_length;
+        // Physical address of the first MemoryMapEntry
+        uint32_t mmap_address;
+    } __attribute__((packed));
+
+    struct MemoryMapEntry {
+        // Size of the entry, *not* counting this field. Entries are variable sized.
+        uint32_t size;
+        uint64_t base_address;
+        uint64_t length;
+        // 1 = Available RAM, everything else is reserved in some way
+        uint32_t type;
+    } __attribute__((packed));
+
+    static const uint32_t memory_available = 1;
+
+    // A file the bootloader loaded along with the kernel
+    struct Module {
+        // Physical, the end is exclusive
+        uint32_t mod_start;
+        uint32_t mod_end;
+        // Physical address of the module's command line, a null-terminated string
+        uint32_t string;
+        uint32_t reserved;
+    } __attribute__((packed));
+};
+
+#endif
@@ -0,0 +1,83 @@
+#include "paging.hpp"
+#include "general_assembly.hpp"
+
+// Defined in loader.s
+extern "C" uint32_t boot_page_directory[1024];
+
+namespace {
+    const uint32_t cpuid_pge = 1 << 13;
+    const uint32_t cr4_pge = 1 << 7;
+
+    uint32_t kernel_flags = Paging::Flags::Present | Paging::Flags::Writable;
+
+    // Large pages in use at the start of the device window
+    uint32_t device_pages = 0;
+}
+
+void Paging::init (uint64_t memory_end) {
+    if (readCPUID(1).edx & cpuid_pge) {
+        writeCR4(readCR4() | cr4_pge);
+        kernel_flags |= Flags::Global;
+    }
+
+    uint64_t end = memory_end;
+    if (end > Memory::direct_map_limit) {
+        end = Memory::direct_map_limit;
+    }
+
+    // This also remaps the kernel image, which the loader mapped without the Global flag
+    for (uint32_t physical = 0; physical < end; physical += large_page_size) {
+        mapLargePage(Memory::kernel_virtual_base + physical, physical, kernel_flags);
+    }
+}
+
+void Paging::mapLargePage (uint32_t virtual_address, uint32_t physical_address, uint32_t flags) {
+    boot_page_directory[virtual_address >> 22] = (physical_address & ~(large_page_size - 1)) | flags | Flags::Present | Flags::Large;
+    invalidatePage(virtual_address);
+}
+
+void Paging::unmapLargePage (uint32_t virtual_address) {
+    boot_page_directory[virtual_address >> 22] = 0;
+    invalidatePage(virtual_address);
+}
+
+void Paging::initialiseCPU () {
+    if (kernel_flags & Flags::Global) {
+        writeCR4(readCR4() | cr4_pge);
+    }
+}
+
+bool Paging::isMapped (uint32_t virtual_address) {
+    return boot_page_directory[virtual_address >> 22] & Flags::Present;
+}
+
+uint32_t Paging::getKernelFlags () {
+    return kernel_flags;
+}
+
+void* Paging::mapDevice (uint32_t physical_address, uint32_t size) {
+    uint32_t first = physical_address & ~(large_page_size - 1);
+    uint32_t count = (physical_address - first + size + large_page_size - 1) / large_page_size;
+
+    // Reuse a run of pages that already maps the whole range
+    for (uint32_t i = 0; i + count <= device_pages; i++) {
+        bool match = true;
+        for (uint32_t j = 0; j < count && match; j++) {
+            uint32_t entry = boot_page_directory[(device_window_start >> 22) + i + j];
+            match = (entry & ~(large_page_size - 1)) == first + j * large_page_size;
+        }
+        if (match) {
+            return (void*)(device_window_start + i * large_page_size + (physical_address - first));
+        }
+    }
+
+    if (device_pages + count > (device_window_end - device_window_start) / large_page_size) {
+        return 0;
+    }
+    uint32_t virtual_start = device_window_start + device_pages * large_page_size;
+    for (uint32_t j = 0; j < count; j++) {
+        mapLargePage(virtual_start + j * large_page_size, first + j * large_page_size, kernel_flags | Flags::CacheDisable | Flags::WriteThrough);
+    }
+    device_pages += count;
+    return (void*)(virtual_start + (physical_address - first));
+}
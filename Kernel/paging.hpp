@@ -0,0 +1,71 @@
+#ifndef INCLUDE_PAGING_H
+#define INCLUDE_PAGING_H
+
+#include "../Include/stdint.h"
+#include "memory.hpp"
+
+/* Paging:
+    loader.s turns paging on with `boot_page_directory` before kmain runs. The kernel is linked at
+    Memory::kernel_virtual_base (3 GiB) + 1 MiB and mapped there with 4 MiB (PSE) pages, so the whole image
+    takes a single TLB entry. The identity map the loader needs to make the jump is removed again
+    before kmain, leaving everything below 3 GiB unmapped for user space.
+    Paging::init then maps the rest of physical memory (up to Memory::direct_map_limit) above
+    kernel_virtual_base, so physical memory can be reached through Memory::physicalToVirtual.
+    Memory-mapped devices (and firmware tables outside the direct map) are mapped uncached into the device
+    window right after the direct map with mapDevice.
+
+    Page directory entry with PSE (4 MiB page):
+    | 31 - 22   | 21 - 13 | 12  | 11 - 9 | 8 | 7  | 6 | 5 | 4   | 3   | 2   | 1   | 0 |
+    | Phys addr | 0       | PAT | Avail  | G | PS | D | A | PCD | PWT | U/S | R/W | P |
+*/
+namespace Paging {
+    static const uint32_t large_page_size = 0x400000;
+
+    static const uint32_t device_window_start = Memory::kernel_virtual_base + Memory::direct_map_limit;
+    static const uint32_t device_window_end = 0xFFC00000;
+
+    struct Flags {
+        static const uint32_t Present = 0x001;
+        static const uint32_t Writable = 0x002;
+        static const uint32_t User = 0x004;
+        static const uint32_t WriteThrough = 0x008;
+        static const uint32_t CacheDisable = 0x010;
+        static const uint32_t Large = 0x080;
+        // Kept in the TLB across cr3 reloads, requires CR4.PGE
+        static const uint32_t Global = 0x100;
+    };
+
+    /** init:
+     * Enables global pages if supported and maps physical memory into the direct map.
+     *
+     * @param memory_end End of physical RAM, only memory below Memory::direct_map_limit is mapped
+     */
+    void init (uint64_t memory_end);
+
+    /** mapLargePage:
+     * Maps a 4 MiB page in the kernel's page directory. Both addresses are rounded down to 4 MiB.
+     *
+     * @param flags Combination of Paging::Flags, Present and Large are always added
+     */
+    void mapLargePage (uint32_t virtual_address, uint32_t physical_address, uint32_t flags);
+    void unmapLargePage (uint32_t virtual_address);
+    bool isMapped (uint32_t virtual_address);
+
+    // For the CPUs started after init: turns on what init turned on for the boot CPU (global pages)
+    void initialiseCPU ();
+
+    // Flags that kernel mappings should use (Global, if the CPU supports it)
+    uint32_t getKernelFlags ();
+
+    /** mapDevice:
+     * Maps physical memory that isn't in the direct map (or must not be cached) into the device window.
+     * Mappings are never taken down, and asking for memory that is already mapped reuses the mapping.
+     *
+     * @param physical_address Start of the range, doesn't need to be aligned
+     * @param size Length of the range in bytes
+     * @return Where the range is mapped, or null if the device window is full
+     */
+    void* mapDevice (uint32_t physical_address, uint32_t size);
+};
+
+#endif
@@ -0,0 +1,200 @@
+#include "slab.hpp"
+#include "memory.hpp"
+#include "buddy_allocator.hpp"
+
+struct Slab::SlabHeader {
+    Slab::Cache* cache;
+    SlabHeader* next;
+    SlabHeader* prev;
+    // First free object
+    void* free_list;
+    uint32_t in_use;
+};
+
+namespace {
+    const uint32_t object_alignment = 8;
+    // Objects start after the header, aligned to 16 bytes
+    const uint32_t first_object_offset = (sizeof(Slab::SlabHeader) + 15) & ~15u;
+
+    // Slabs grow (up to order 3, 32 KiB) until they hold at least this many objects
+    const uint32_t min_objects_per_slab = 8;
+    const uint32_t max_slab_order = 3;
+
+    // Keep one empty slab around so that alloc/free at a slab boundary doesn't thrash the buddy allocator
+    const uint32_t max_empty_slabs = 1;
+
+    uint32_t getSlabSize (const Slab::Cache& cache) {
+        return FrameAllocator::frame_size << cache.slab_order;
+    }
+
+    void*& getLink (const Slab::Cache& cache, void* object) {
+        return *(void**)((uint8_t*)object + cache.link_offset);
+    }
+
+    void pushSlab (Slab::SlabHeader*& list, Slab::SlabHeader* slab) {
+        slab->prev = 0;
+        slab->next = list;
+        if (list != 0) {
+            list->prev = slab;
+        }
+        list = slab;
+    }
+
+    void removeSlab (Slab::SlabHeader*& list, Slab::SlabHeader* slab) {
+        if (slab->prev != 0) {
+            slab->prev->next = slab->next;
+        } else {
+            list = slab->next;
+        }
+        if (slab->next != 0) {
+            slab->next->prev = slab->prev;
+        }
+    }
+
+    Slab::SlabHeader* createSlab (Slab::Cache& cache) {
+        if (cache.objects_per_slab == 0) {
+            // Not initialised
+            return 0;
+        }
+
+        BuddyAllocator::PhysicalAddress address = BuddyAllocator::allocate(cache.slab_order);
+        if (address == 0) {
+            return 0;
+        }
+        BuddyAllocator::setSlab(address, true);
+
+        Slab::SlabHeader* slab = (Slab::SlabHeader*)Memory::physicalToVirtual(address);
+        slab->cache = &cache;
+        slab->in_use = 0;
+        slab->free_list = 0;
+
+        // Built back to front so objects are handed out in address order
+        uint8_t* objects = (uint8_t*)slab + first_object_offset;
+        for (uint32_t i = cache.objects_per_slab; i-- > 0;) {
+            void* object = objects + i * cache.stride;
+            if (cache.constructor) {
+                cache.constructor(object);
+            }
+            getLink(cache, object) = slab->free_list;
+            slab->free_list = object;
+        }
+
+        cache.slab_count++;
+        return slab;
+    }
+
+    void destroySlab (Slab::Cache& cache, Slab::SlabHeader* slab) {
+        if (cache.destructor) {
+            uint8_t* objects = (uint8_t*)slab + first_object_offset;
+            for (uint32_t i = 0; i < cache.objects_per_slab; i++) {
+                cache.destructor(objects + i * cache.stride);
+            }
+        }
+
+        BuddyAllocator::PhysicalAddress address = Memory::virtualToPhysical(slab);
+        BuddyAllocator::setSlab(address, false);
+        BuddyAllocator::free(address);
+        cache.slab_count--;
+    }
+}
+
+void Slab::initCache (Slab::Cache& cache, const char* name, uint32_t size, Slab::Constructor constructor, Slab::Destructor destructor) {
+    Memory::memset(&cache, 0, sizeof(cache));
+    cache.name = name;
+    cache.object_size = size;
+    cache.constructor = constructor;
+    cache.destructor = destructor;
+
+    if (size < sizeof(void*)) {
+        size = sizeof(void*);
+    }
+    if (constructor) {
+        // Constructed objects must stay intact while free, so the link goes after them
+        size = (size + sizeof(void*) - 1) & ~(sizeof(void*) - 1);
+        cache.link_offset = size;
+        size += sizeof(void*);
+    }
+    cache.stride = (size + object_alignment - 1) & ~(object_alignment - 1);
+
+    cache.slab_order = 0;
+    while (true) {
+        cache.objects_per_slab = (getSlabSize(cache) - first_object_offset) / cache.stride;
+        if (cache.objects_per_slab >= min_objects_per_slab || cache.slab_order == max_slab_order) {
+            break;
+        }
+        cache.slab_order++;
+    }
+}
+
+void* Slab::allocate (Slab::Cache& cache) {
+    SlabHeader* slab = cache.partial;
+    if (slab == 0) {
+        slab = cache.empty;
+        if (slab != 0) {
+            removeSlab(cache.empty, slab);
+            cache.empty_count--;
+        } else {
+            slab = createSlab(cache);
+            if (slab == 0) {
+                return 0;
+            }
+        }
+        pushSlab(cache.partial, slab);
+    }
+
+    void* object = slab->free_list;
+    slab->free_list = getLink(cache, object);
+    slab->in_use++;
+    cache.active_objects++;
+
+    if (slab->in_use == cache.objects_per_slab) {
+        removeSlab(cache.partial, slab);
+        pushSlab(cache.full, slab);
+    }
+    return object;
+}
+
+void Slab::free (Slab::Cache& cache, void* object) {
+    if (object == 0) {
+        return;
+    }
+
+    SlabHeader* slab = (SlabHeader*)((uint32_t)object & ~(getSlabSize(cache) - 1));
+
+    if (slab->in_use == cache.objects_per_slab) {
+        removeSlab(cache.full, slab);
+        pushSlab(cache.partial, slab);
+    }
+
+    getLink(cache, object) = slab->free_list;
+    slab->free_list = object;
+    slab->in_use--;
+    cache.active_objects--;
+
+    if (slab->in_use == 0) {
+        removeSlab(cache.partial, slab);
+        if (cache.empty_count < max_empty_slabs) {
+            pushSlab(cache.empty, slab);
+            cache.empty_count++;
+        } else {
+            destroySlab(cache, slab);
+        }
+    }
+}
+
+Slab::Cache* Slab::getCache (void* object) {
+    BuddyAllocator::PhysicalAddress block = BuddyAllocator::getBlockStart(Memory::virtualToPhysical(object));
+    if (block == 0 || !BuddyAllocator::isSlab(block)) {
+        return 0;
+    }
+    return ((SlabHeader*)Memory::physicalToVirtual(block))->cache;
+}
+
+void Slab::shrink (Slab::Cache& cache) {
+    while (cache.empty != 0) {
+        SlabHeader* slab = cache.empty;
+        removeSlab(cache.empty, slab);
+        destroySlab(cache, slab);
+    }
+    cache.empty_count = 0;
+}
@@ -0,0 +1,73 @@
+#ifndef INCLUDE_SLAB_H
+#define INCLUDE_SLAB_H
+
+#include "../Include/stdint.h"
+
+/* Slab Allocator:
+    An object cache hands out objects of one fixed size. Its memory comes in slabs, which are buddy blocks
+    with a SlabHeader at the start followed by as many objects as fit.
+    Free objects of a slab form a singly linked list threaded through the objects themselves, so allocating
+    is popping the head of the first partially used slab's list, and freeing is pushing onto it.
+    Slabs are aligned to their own size, so the slab (and the cache) an object belongs to is found by masking
+    the object's address.
+
+    Constructor/Destructor:
+    If a cache has a constructor, objects are constructed once when their slab is created and are expected to
+    be given back in their constructed state. The destructor runs when the slab is returned to the buddy
+    allocator. For those caches the free list link is stored after the object, so it doesn't clobber it.
+*/
+namespace Slab {
+    using Constructor = void (*) (void* object);
+    using Destructor = void (*) (void* object);
+
+    struct SlabHeader;
+
+    // Plain data so that caches can be statically allocated (global constructors aren't run).
+    // Set up with initCache before use.
+    struct Cache {
+        const char* name;
+        uint32_t object_size;
+        // Distance between two objects in a slab
+        uint32_t stride;
+        // Where the free list link lives inside a free object
+        uint32_t link_offset;
+        uint32_t objects_per_slab;
+        uint32_t slab_order;
+
+        Constructor constructor;
+        Destructor destructor;
+
+        SlabHeader* partial;
+        SlabHeader* full;
+        SlabHeader* empty;
+        uint32_t empty_count;
+
+        uint32_t slab_count;
+        uint32_t active_objects;
+    };
+
+    /** initCache:
+     * @param cache The cache to set up
+     * @param name Name for diagnostics, must outlive the cache
+     * @param size Size of each object in bytes
+     * @param constructor Optional, run on every object when a slab is created
+     * @param destructor Optional, run on every object when a slab is destroyed
+     */
+    void initCache (Cache& cache, const char* name, uint32_t size, Constructor constructor=0, Destructor destructor=0);
+
+    /** allocate:
+     * @return An object from the cache, or null if no memory could be found for a new slab
+     */
+    void* allocate (Cache& cache);
+    void free (Cache& cache, void* object);
+
+    /** getCache:
+     * @return The cache that the object was allocated from, or null if it isn't a slab object
+     */
+    Cache* getCache (void* object);
+
+    // Gives all empty slabs back to the buddy allocator
+    void shrink (Cache& cache);
+};
+
+#endif
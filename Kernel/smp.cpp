@@ -0,0 +1,143 @@
+#include "smp.hpp"
+#include "cpu.hpp"
+#include "apic.hpp"
+#include "irq.hpp"
+#include "clock.hpp"
+#include "descriptor_tables.hpp"
+#include "general_assembly.hpp"
+#include "memory.hpp"
+#include "paging.hpp"
+#include "thread.hpp"
+#include "timer.hpp"
+#include "isr.hpp"
+
+// Defined in trampoline.s
+extern "C" uint8_t trampoline_start[];
+extern "C" uint8_t trampoline_end[];
+extern "C" uint8_t trampoline_parameters[];
+
+namespace {
+    // Must match trampoline_parameters in trampoline.s
+    struct TrampolineParameters {
+        uint32_t page_directory;
+        uint32_t stack;
+        uint32_t entry;
+        uint32_t cpu_index;
+    } __attribute__((packed));
+
+    const uint64_t init_delay = 10000000;
+    const uint64_t startup_delay = 200000;
+    // How long to give a CPU to report in after the second startup IPI
+    const uint64_t online_timeout = 100000000;
+
+    uint8_t stacks[CPU::max_cpus][SMP::stack_size] __attribute__((aligned(16)));
+
+    // Set once the boot CPU has taken the identity map of the trampoline down again
+    bool released = false;
+
+    void delay (uint64_t nanoseconds) {
+        uint64_t until = Clock::now() + nanoseconds;
+        while (Clock::now() < until) {
+            __asm__ volatile ("pause");
+        }
+    }
+
+    bool waitOnline (uint32_t index, uint64_t nanoseconds) {
+        uint64_t until = Clock::now() + nanoseconds;
+        while (!__atomic_load_n(&CPU::get(index).online, __ATOMIC_ACQUIRE)) {
+            if (Clock::now() >= until) {
+                return false;
+            }
+            __asm__ volatile ("pause");
+        }
+        return true;
+    }
+
+    uint32_t getStackTop (uint32_t index) {
+        return (uint32_t)&stacks[index][SMP::stack_size];
+    }
+
+    // The other CPUs' time slices run on their local APIC timer, the boot CPU's on the PIT
+    void timerHandler (ISR::Frame*) {
+        LocalAPIC::sendEOI();
+        Thread::tick();
+    }
+
+    // Jumped to by the trampoline, with the index pushed as the argument
+    [[noreturn]] void apMain (uint32_t index) {
+        CPU::initialise(index, LocalAPIC::getID(), getStackTop(index));
+        IDT::load();
+        Paging::initialiseCPU();
+        LocalAPIC::initialiseCPU();
+
+        while (!__atomic_load_n(&released, __ATOMIC_ACQUIRE)) {
+            __asm__ volatile ("pause");
+        }
+        // Drops this CPU's TLB entries for the identity map
+        writeCR3(readCR3());
+        LocalAPIC::startTimer();
+
+        Thread::initialiseCPU();
+    }
+
+    // The parameters are only read by the trampoline, so once this returns the next CPU can have them
+    bool startCPU (uint32_t index, uint8_t apic_id, TrampolineParameters* parameters) {
+        parameters->stack = getStackTop(index);
+        parameters->cpu_index = index;
+
+        LocalAPIC::sendIPI(apic_id, LocalAPIC::ICR::deliveryInit | LocalAPIC::ICR::levelAssert);
+        delay(init_delay);
+        // The second startup IPI is only for CPUs that missed the first
+        for (uint32_t attempt = 0; attempt < 2; attempt++) {
+            LocalAPIC::sendIPI(apic_id, LocalAPIC::ICR::deliveryStartup | (SMP::trampoline_address >> 12));
+            if (waitOnline(index, startup_delay)) {
+                return true;
+            }
+        }
+        if (waitOnline(index, online_timeout)) {
+            return true;
+        }
+        // It may still be on its way through the trampoline, or about to read the parameters. An INIT
+        // stops it wherever it is and leaves it waiting for a startup IPI, which it never gets.
+        LocalAPIC::sendIPI(apic_id, LocalAPIC::ICR::deliveryInit | LocalAPIC::ICR::levelAssert);
+        delay(init_delay);
+        return false;
+    }
+}
+
+uint32_t SMP::initialise () {
+    const ACPI::InterruptInfo* info = IRQ::getInterruptInfo();
+    if (!info || info->cpu_count < 2) {
+        return CPU::getOnlineCount();
+    }
+
+    uint8_t boot_id = LocalAPIC::getID();
+    CPU::get(0).apic_id = boot_id;
+    LocalAPIC::calibrateTimer(Timer::getFrequency());
+    ISR::setIRQHandler(LocalAPIC::timer_vector, timerHandler);
+
+    // The first MiB is reserved by FrameAllocator, so the trampoline page is free to overwrite
+    uint8_t* trampoline = (uint8_t*)Memory::physicalToVirtual(trampoline_address);
+    Memory::memcpy(trampoline, trampoline_start, trampoline_end - trampoline_start);
+    TrampolineParameters* parameters = (TrampolineParameters*)(trampoline + (trampoline_parameters - trampoline_start));
+    parameters->page_directory = readCR3();
+    parameters->entry = (uint32_t)apMain;
+
+    // The trampoline turns paging on while running from its physical address
+    Paging::mapLargePage(0, 0, Paging::Flags::Writable);
+
+    uint32_t index = 1;
+    for (uint32_t i = 0; i < info->cpu_count && index < CPU::max_cpus; i++) {
+        if (info->cpu_apic_ids[i] == boot_id) {
+            continue;
+        }
+        // A CPU that timed out is held in INIT, but it may have got into apMain and written its CPU::Data
+        // before that, so its index and stack aren't given to the next
+        startCPU(index, info->cpu_apic_ids[i], parameters);
+        index++;
+    }
+
+    Paging::unmapLargePage(0);
+    __atomic_store_n(&released, true, __ATOMIC_RELEASE);
+    return CPU::getOnlineCount();
+}
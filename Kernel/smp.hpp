@@ -0,0 +1,30 @@
+#ifndef INCLUDE_SMP_H
+#define INCLUDE_SMP_H
+
+#include "../Include/stdint.h"
+
+/* SMP:
+    Starts the other CPUs (application processors, APs) that the MADT lists. Each is woken with the
+    INIT-SIPI-SIPI sequence: an INIT IPI, 10 ms, then up to two startup IPIs 200 us apart, whose vector is
+    the page the CPU starts executing at in real mode. That page gets a copy of the trampoline (see
+    trampoline.s), which goes to protected mode, turns on paging with the boot CPU's page directory and
+    jumps to the AP's entry in the higher half on its own stack.
+    The entry gives the CPU its per-CPU area (see CPU), loads the IDT, enables its local APIC and reports
+    in. CPUs are started one at a time since they share the trampoline's parameters. One that doesn't
+    report in within 100 ms is sent another INIT, which stops it before the next CPU's parameters go in.
+    Device interrupts all still go to the boot CPU. The others become their own idle thread (see Thread).
+*/
+namespace SMP {
+    static const uint32_t trampoline_address = 0x7000;
+    static const uint32_t stack_size = 16384;
+
+    /** initialise:
+     * Starts every CPU the MADT lists. Does nothing when the interrupts don't go through the APIC (see
+     * IRQ::getController). Needs Clock and Timer for the delays, and CPU::initialise done for the boot CPU.
+     *
+     * @return The number of CPUs online, the boot CPU included
+     */
+    uint32_t initialise ();
+};
+
+#endif
@@ -0,0 +1,136 @@
+#include "spinlock.hpp"
+#include "general_assembly.hpp"
+
+namespace {
+    // Pushed onto from any CPU, never removed from
+    Spinlock::Stats* stats_list = 0;
+
+    // With the lock held
+    void acquired (Spinlock::Stats& stats, bool contended) {
+        if (Spinlock::stats_enabled) {
+            stats.acquisitions++;
+            if (contended) {
+                stats.contended++;
+            }
+            stats.acquired_at = readTimestampCounter();
+        }
+    }
+
+    // With the lock still held
+    void releasing (Spinlock::Stats& stats) {
+        if (Spinlock::stats_enabled) {
+            uint32_t held = (uint32_t)(readTimestampCounter() - stats.acquired_at);
+            stats.total_hold_cycles += held;
+            if (held > stats.max_hold_cycles) {
+                stats.max_hold_cycles = held;
+            }
+        }
+    }
+}
+
+void Spinlock::lock (Spinlock::Ticket& lock) {
+    uint16_t ticket = __atomic_fetch_add(&lock.tickets.half.next, 1, __ATOMIC_RELAXED);
+    bool contended = false;
+    while (__atomic_load_n(&lock.tickets.half.serving, __ATOMIC_ACQUIRE) != ticket) {
+        contended = true;
+        __asm__ volatile ("pause");
+    }
+    acquired(lock.stats, contended);
+}
+
+bool Spinlock::tryLock (Spinlock::Ticket& lock) {
+    uint32_t value = __atomic_load_n(&lock.tickets.value, __ATOMIC_RELAXED);
+    // Free when the next ticket to hand out is the one being served
+    if ((value >> 16) != (value & 0xFFFF)) {
+        return false;
+    }
+    // Taking the ticket is adding 1 to the high half, which wraps by dropping the carry
+    if (!__atomic_compare_exchange_n(&lock.tickets.value, &value, value + 0x10000, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+        return false;
+    }
+    acquired(lock.stats, false);
+    return true;
+}
+
+void Spinlock::unlock (Spinlock::Ticket& lock) {
+    releasing(lock.stats);
+    // Only the holder writes serving
+    __atomic_store_n(&lock.tickets.half.serving, (uint16_t)(lock.tickets.half.serving + 1), __ATOMIC_RELEASE);
+}
+
+uint32_t Spinlock::lockIRQSave (Spinlock::Ticket& lock) {
+    uint32_t flags = saveAndDisableInterrupts();
+    Spinlock::lock(lock);
+    return flags;
+}
+
+void Spinlock::unlockIRQRestore (Spinlock::Ticket& lock, uint32_t flags) {
+    Spinlock::unlock(lock);
+    restoreInterrupts(flags);
+}
+
+void Spinlock::lock (Spinlock::MCS& lock, Spinlock::MCSNode& node) {
+    node.next = 0;
+    node.waiting = 1;
+    MCSNode* previous = __atomic_exchange_n(&lock.tail, &node, __ATOMIC_ACQ_REL);
+    if (previous) {
+        __atomic_store_n(&previous->next, &node, __ATOMIC_RELEASE);
+        while (__atomic_load_n(&node.waiting, __ATOMIC_ACQUIRE)) {
+            __asm__ volatile ("pause");
+        }
+    }
+    acquired(lock.stats, previous != 0);
+}
+
+bool Spinlock::tryLock (Spinlock::MCS& lock, Spinlock::MCSNode& node) {
+    node.next = 0;
+    node.waiting = 0;
+    MCSNode* expected = 0;
+    if (!__atomic_compare_exchange_n(&lock.tail, &expected, &node, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+        return false;
+    }
+    acquired(lock.stats, false);
+    return true;
+}
+
+void Spinlock::unlock (Spinlock::MCS& lock, Spinlock::MCSNode& node) {
+    releasing(lock.stats);
+    MCSNode* next = __atomic_load_n(&node.next, __ATOMIC_ACQUIRE);
+    if (!next) {
+        // Nobody is queued, unless someone has swapped themselves in as the tail and not linked up yet
+        MCSNode* expected = &node;
+        if (__atomic_compare_exchange_n(&lock.tail, &expected, (MCSNode*)0, false, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+            return;
+        }
+        while (!(next = __atomic_load_n(&node.next, __ATOMIC_ACQUIRE))) {
+            __asm__ volatile ("pause");
+        }
+    }
+    __atomic_store_n(&next->waiting, 0, __ATOMIC_RELEASE);
+}
+
+uint32_t Spinlock::lockIRQSave (Spinlock::MCS& lock, Spinlock::MCSNode& node) {
+    uint32_t flags = saveAndDisableInterrupts();
+    Spinlock::lock(lock, node);
+    return flags;
+}
+
+void Spinlock::unlockIRQRestore (Spinlock::MCS& lock, Spinlock::MCSNode& node, uint32_t flags) {
+    Spinlock::unlock(lock, node);
+    restoreInterrupts(flags);
+}
+
+void Spinlock::addStats (Spinlock::Stats& stats, const char* name) {
+    const char* expected = 0;
+    if (!__atomic_compare_exchange_n(&stats.name, &expected, name, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        return;
+    }
+    Stats* head = __atomic_load_n(&stats_list, __ATOMIC_RELAXED);
+    do {
+        stats.next = head;
+    } while (!__atomic_compare_exchange_n(&stats_list, &head, &stats, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+const Spinlock::Stats* Spinlock::getStats () {
+    return __atomic_load_n(&stats_list, __ATOMIC_ACQUIRE);
+}
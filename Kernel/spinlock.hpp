@@ -0,0 +1,112 @@
+#ifndef INCLUDE_SPINLOCK_H
+#define INCLUDE_SPINLOCK_H
+
+#include "../Include/stdint.h"
+
+/* Spinlock:
+    Locks for state shared between CPUs, or between a thread and an interrupt handler. Both kinds are fair,
+    they are taken in the order they were asked for, so no CPU can be starved by the others.
+
+    Ticket: a counter of tickets handed out and one of the ticket being served. lock takes the next ticket
+    and spins until it is served, unlock serves the next one. Everyone spins on the same word, so it is for
+    locks that are rarely fought over.
+    MCS: waiters queue up in a linked list of nodes that they bring themselves (usually on their stack),
+    and each spins on its own node until the one before it hands the lock over. Only the handover touches
+    another CPU's cache line, so it holds up under heavy contention. The same node has to be given to
+    unlock.
+
+    Neither kind nests, and a lock that an interrupt handler takes must only be taken with interrupts
+    disabled elsewhere (lockIRQSave), or the handler spins forever on the lock its own CPU holds.
+
+    Statistics: built with `make LOCK_STATS=1` (KERNEL_LOCK_STATS), every acquisition counts in its lock's
+    Stats: how often it was taken, how often it had to wait, and how long it was held. Locks added with
+    addStats are listed by the `locks` console command. Without it the Stats stay 0 and cost nothing.
+
+    Usage:
+        Spinlock::Ticket lock;    // Plain data, zero is unlocked
+        uint32_t flags = Spinlock::lockIRQSave(lock);
+        ...
+        Spinlock::unlockIRQRestore(lock, flags);
+
+        Spinlock::MCSNode node;
+        Spinlock::lock(mcs, node);
+        ...
+        Spinlock::unlock(mcs, node);
+*/
+namespace Spinlock {
+#ifdef KERNEL_LOCK_STATS
+    static const bool stats_enabled = true;
+#else
+    static const bool stats_enabled = false;
+#endif
+
+    // Written by the holder, so they need no atomics
+    struct Stats {
+        uint64_t acquisitions;
+        // Acquisitions that had to wait for another holder
+        uint64_t contended;
+        uint64_t total_hold_cycles;
+        uint32_t max_hold_cycles;
+        uint64_t acquired_at;
+
+        // See addStats
+        const char* name;
+        Stats* next;
+    };
+
+    struct Ticket {
+        // Both halves in one word, so that tryLock can take a ticket only if it is served right away
+        union {
+            uint32_t value;
+            struct {
+                uint16_t serving;
+                uint16_t next;
+            } half;
+        } tickets;
+        Stats stats;
+    };
+
+    struct MCSNode {
+        MCSNode* next;
+        // Set while it waits, cleared by the holder before it to hand the lock over
+        uint32_t waiting;
+    };
+
+    struct MCS {
+        // The last node in the queue, null when the lock is free
+        MCSNode* tail;
+        Stats stats;
+    };
+
+    void lock (Ticket& lock);
+    // @return false if it is held, without waiting
+    bool tryLock (Ticket& lock);
+    void unlock (Ticket& lock);
+
+    /** lockIRQSave:
+     * Disables interrupts and then takes the lock.
+     *
+     * @return The EFLAGS from before, to give to unlockIRQRestore
+     */
+    uint32_t lockIRQSave (Ticket& lock);
+    // Releases the lock and then enables interrupts again, if they were enabled before lockIRQSave
+    void unlockIRQRestore (Ticket& lock, uint32_t flags);
+
+    // `node` must stay where it is until unlock
+    void lock (MCS& lock, MCSNode& node);
+    bool tryLock (MCS& lock, MCSNode& node);
+    void unlock (MCS& lock, MCSNode& node);
+    uint32_t lockIRQSave (MCS& lock, MCSNode& node);
+    void unlockIRQRestore (MCS& lock, MCSNode& node, uint32_t flags);
+
+    /** addStats:
+     * Adds a lock's statistics to the list the `locks` command shows. Adding the same one twice does nothing.
+     *
+     * @param name Must live forever
+     */
+    void addStats (Stats& stats, const char* name);
+    // The first in the list, follow next for the others
+    const Stats* getStats ();
+};
+
+#endif
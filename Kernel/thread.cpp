@@ -0,0 +1,314 @@
+#include "thread.hpp"
+#include "cpu.hpp"
+#include "deferred.hpp"
+#include "heap.hpp"
+#include "timer.hpp"
+#include "general_assembly.hpp"
+
+namespace {
+    // The contexts that were running before there were threads: kmain, and the other CPUs' entries
+    Thread::Control adopted[CPU::max_cpus];
+    uint32_t next_id = 0;
+
+    // With interrupts off
+    void lock (Thread::RunQueue& queue) {
+        Spinlock::lock(queue.lock);
+    }
+    void unlock (Thread::RunQueue& queue) {
+        Spinlock::unlock(queue.lock);
+    }
+
+    // With the queue locked
+    void pushBack (Thread::RunQueue& queue, Thread::Control* thread) {
+        uint8_t priority = thread->priority;
+        thread->next = 0;
+        if (queue.tails[priority]) {
+            queue.tails[priority]->next = thread;
+        } else {
+            queue.heads[priority] = thread;
+            queue.bitmap |= 1 << priority;
+        }
+        queue.tails[priority] = thread;
+        __atomic_store_n(&queue.count, queue.count + 1, __ATOMIC_RELAXED);
+    }
+
+    // With the queue locked
+    Thread::Control* popFront (Thread::RunQueue& queue, uint32_t priority) {
+        Thread::Control* thread = queue.heads[priority];
+        queue.heads[priority] = thread->next;
+        if (!thread->next) {
+            queue.tails[priority] = 0;
+            queue.bitmap &= ~(1 << priority);
+        }
+        __atomic_store_n(&queue.count, queue.count - 1, __ATOMIC_RELAXED);
+        return thread;
+    }
+
+    void enqueue (CPU::Data* cpu, Thread::Control* thread) {
+        thread->state = Thread::State::Ready;
+        thread->cpu = cpu->index;
+        lock(cpu->run_queue);
+        pushBack(cpu->run_queue, thread);
+        unlock(cpu->run_queue);
+    }
+
+    // Takes the next thread of the CPU with the most ready, with interrupts off
+    Thread::Control* steal (CPU::Data* cpu) {
+        CPU::Data* busiest = 0;
+        uint32_t most = 0;
+        for (uint32_t i = 0; i < CPU::max_cpus; i++) {
+            CPU::Data& other = CPU::get(i);
+            // Read without the lock, it only has to be about right
+            uint32_t count = __atomic_load_n(&other.run_queue.count, __ATOMIC_RELAXED);
+            if (&other != cpu && count > most) {
+                busiest = &other;
+                most = count;
+            }
+        }
+        if (!busiest) {
+            return 0;
+        }
+
+        Thread::Control* thread = 0;
+        lock(busiest->run_queue);
+        if (busiest->run_queue.bitmap) {
+            thread = popFront(busiest->run_queue, __builtin_ctz(busiest->run_queue.bitmap));
+        }
+        unlock(busiest->run_queue);
+        if (thread) {
+            thread->cpu = cpu->index;
+            cpu->steals++;
+        }
+        return thread;
+    }
+
+    // Runs on the thread that was switched to, once it is off the previous thread's stack
+    void finishSwitch () {
+        CPU::Data* cpu = CPU::current();
+        Thread::Control* requeue = cpu->requeue;
+        if (requeue) {
+            cpu->requeue = 0;
+            enqueue(cpu, requeue);
+        }
+        Thread::Control* dead = cpu->dead;
+        if (dead) {
+            cpu->dead = 0;
+            kfree(dead->stack);
+            kfree(dead);
+        }
+    }
+
+    // With interrupts off. The current thread must already be in cpu->requeue, marked dead, or be the idle one.
+    void switchTo (CPU::Data* cpu, Thread::Control* next) {
+        Thread::Control* previous = cpu->current_thread;
+        next->state = Thread::State::Running;
+        cpu->current_thread = next;
+        cpu->slice = Thread::time_slice;
+        cpu->need_reschedule = false;
+        if (next == previous) {
+            return;
+        }
+        cpu->switches++;
+        Thread::switch_context(&previous->esp, next->esp);
+        finishSwitch();
+    }
+
+    // With interrupts off
+    void schedule (CPU::Data* cpu) {
+        Thread::Control* previous = cpu->current_thread;
+        bool runnable = previous->state == Thread::State::Running && previous != cpu->idle_thread;
+
+        Thread::Control* next = 0;
+        Thread::RunQueue& queue = cpu->run_queue;
+        lock(queue);
+        if (queue.bitmap) {
+            uint32_t priority = __builtin_ctz(queue.bitmap);
+            // Equal priorities take turns
+            if (!runnable || priority <= previous->priority) {
+                next = popFront(queue, priority);
+            }
+        }
+        unlock(queue);
+
+        if (!next) {
+            if (runnable) {
+                cpu->slice = Thread::time_slice;
+                cpu->need_reschedule = false;
+                return;
+            }
+            next = steal(cpu);
+            if (!next) {
+                if (previous == cpu->idle_thread) {
+                    return;
+                }
+                next = cpu->idle_thread;
+            }
+        }
+
+        if (runnable) {
+            previous->state = Thread::State::Ready;
+            cpu->requeue = previous;
+        } else if (previous == cpu->idle_thread) {
+            previous->state = Thread::State::Ready;
+        }
+        switchTo(cpu, next);
+    }
+
+    // Where a new thread's first switch_context returns to
+    [[noreturn]] void start () {
+        finishSwitch();
+        __asm__ volatile ("sti" : : : "memory");
+        Thread::Control* thread = Thread::current();
+        thread->entry(thread->data);
+        Thread::exit();
+    }
+
+    [[noreturn]] void idle (void*) {
+        while (true) {
+            // Runs whatever is ready here or can be stolen, and comes back once there is nothing left
+            Thread::yield();
+            // What the interrupts left over, see Deferred::restart_limit
+            Deferred::run();
+
+            __asm__ volatile ("cli" : : : "memory");
+            // Checked with interrupts off, so the halt can't miss an interrupt that made a thread ready.
+            // On the other CPUs the local APIC timer wakes it up to look for threads to steal.
+            if (Thread::hasReady() || Deferred::hasPending()) {
+                __asm__ volatile ("sti" : : : "memory");
+            } else {
+                Timer::idle();
+            }
+        }
+    }
+
+    Thread::Control* make (Thread::EntryFunction entry, void* data, const char* name, uint8_t priority) {
+        // From kmalloc rather than a Slab::Cache of their own, since they are created and freed on every CPU
+        Thread::Control* thread = (Thread::Control*)kmalloc(sizeof(Thread::Control));
+        if (!thread) {
+            return 0;
+        }
+        thread->stack = (uint8_t*)kmalloc(Thread::stack_size);
+        if (!thread->stack) {
+            kfree(thread);
+            return 0;
+        }
+        thread->id = __atomic_fetch_add(&next_id, 1, __ATOMIC_RELAXED);
+        thread->state = Thread::State::Ready;
+        thread->name = name;
+        thread->priority = priority < Thread::priority_count ? priority : Thread::priority_count - 1;
+        thread->cpu = CPU::getIndex();
+        thread->entry = entry;
+        thread->data = data;
+        thread->next = 0;
+
+        // What switch_context pops: edi, esi, ebx, ebp, then the return address. start never returns, the
+        // last slot is only there to keep the stack looking like a call was made.
+        uint32_t* stack = (uint32_t*)(thread->stack + Thread::stack_size);
+        *--stack = 0;
+        *--stack = (uint32_t)start;
+        *--stack = 0;
+        *--stack = 0;
+        *--stack = 0;
+        *--stack = 0;
+        thread->esp = (uint32_t)stack;
+        return thread;
+    }
+
+    Thread::Control* adopt (const char* name) {
+        CPU::Data* cpu = CPU::current();
+        Thread::Control* thread = &adopted[cpu->index];
+        thread->esp = 0;
+        thread->id = __atomic_fetch_add(&next_id, 1, __ATOMIC_RELAXED);
+        thread->state = Thread::State::Running;
+        thread->name = name;
+        thread->priority = Thread::default_priority;
+        thread->cpu = cpu->index;
+        thread->entry = 0;
+        thread->data = 0;
+        thread->stack = 0;
+        thread->next = 0;
+        cpu->current_thread = thread;
+        cpu->slice = Thread::time_slice;
+        return thread;
+    }
+}
+
+void Thread::initialise () {
+    adopt("main");
+
+    // Only run when there is nothing else, so it is never queued
+    CPU::current()->idle_thread = make(idle, 0, "idle", priority_count - 1);
+}
+
+void Thread::initialiseCPU () {
+    CPU::current()->idle_thread = adopt("idle");
+    idle(0);
+}
+
+Thread::Control* Thread::create (Thread::EntryFunction entry, void* data, const char* name, uint8_t priority) {
+    Control* thread = make(entry, data, name, priority);
+    if (!thread) {
+        return 0;
+    }
+    uint32_t flags = saveAndDisableInterrupts();
+    CPU::Data* cpu = CPU::current();
+    enqueue(cpu, thread);
+    // Switched to when the current interrupt (or the next one) returns
+    if (cpu->current_thread == cpu->idle_thread || thread->priority < cpu->current_thread->priority) {
+        cpu->need_reschedule = true;
+    }
+    restoreInterrupts(flags);
+    return thread;
+}
+
+Thread::Control* Thread::current () {
+    return CPU::current()->current_thread;
+}
+
+void Thread::yield () {
+    uint32_t flags = saveAndDisableInterrupts();
+    schedule(CPU::current());
+    restoreInterrupts(flags);
+}
+
+void Thread::exit () {
+    __asm__ volatile ("cli" : : : "memory");
+    CPU::Data* cpu = CPU::current();
+    cpu->current_thread->state = State::Dead;
+    // Only threads from create have a stack to free, the adopted ones just stop
+    if (cpu->current_thread->stack) {
+        cpu->dead = cpu->current_thread;
+    }
+    schedule(cpu);
+    // Dead threads are never switched back to
+    while (true) {}
+}
+
+bool Thread::hasReady () {
+    return __atomic_load_n(&CPU::current()->run_queue.count, __ATOMIC_RELAXED) != 0;
+}
+
+void Thread::disablePreemption () {
+    CPU::current()->preempt_disabled++;
+}
+
+void Thread::enablePreemption () {
+    CPU::current()->preempt_disabled--;
+}
+
+void Thread::tick () {
+    CPU::Data* cpu = CPU::current();
+    if (cpu->slice > 0) {
+        cpu->slice--;
+    }
+    if (cpu->slice == 0 && Thread::hasReady()) {
+        cpu->need_reschedule = true;
+    }
+}
+
+extern "C" void Thread::preempt_if_needed () {
+    CPU::Data* cpu = CPU::current();
+    if (cpu->need_reschedule && cpu->preempt_disabled == 0 && cpu->current_thread) {
+        schedule(cpu);
+    }
+}
@@ -0,0 +1,122 @@
+#ifndef INCLUDE_THREAD_H
+#define INCLUDE_THREAD_H
+
+#include "../Include/stdint.h"
+#include "spinlock.hpp"
+
+/* Thread:
+    Kernel threads, each with its own stack. A thread that isn't running is described entirely by its
+    saved esp: switch_context (context_switch.s) pushes only the registers a function call preserves (ebx,
+    esi, edi, ebp) and swaps stacks, anything else is already saved by the caller or dead.
+
+    Scheduling: every CPU has its own RunQueue in its CPU::Data, with a FIFO list of ready threads per
+    priority level (0 is the highest) and a bitmap of the levels that aren't empty, so the next thread is
+    the head of level ctz(bitmap), whatever the number of threads. The running thread keeps the CPU while
+    nothing of at least its priority is ready, and threads of the same priority take turns.
+    A CPU normally only touches its own queue. When it runs out of threads it steals the next thread of
+    the CPU with the most ready ones, so each queue has a lock, but it is only contended by stealing.
+    A thread is only put back on a queue once switch_context has saved its esp (see finishSwitch), so that
+    it can't be stolen by another CPU before then. When there is nothing to run or steal, the CPU runs its
+    idle thread, which halts.
+
+    Preemption: the timer interrupt (the PIT on the boot CPU, the local APIC timer on the others) counts
+    down the running thread's time slice and asks for a reschedule when it runs out and something else is
+    ready. isr_common_stub calls preempt_if_needed after every handler, which switches threads right there.
+    The interrupt frame stays on the old thread's stack, and when it is resumed (on any CPU) the stub
+    carries on and irets to where it was interrupted.
+    Code that must not be switched away from with interrupts on (like Timer::idle) uses
+    disablePreemption/enablePreemption.
+*/
+namespace Thread {
+    enum class State : uint8_t {
+        Ready,
+        Running,
+        Dead,
+    };
+
+    using EntryFunction = void (*) (void* data);
+
+    static const uint32_t stack_size = 8192;
+    // In timer ticks
+    static const uint32_t time_slice = 10;
+    static const uint32_t priority_count = 32;
+    static const uint8_t default_priority = 16;
+
+    struct Control {
+        // Saved by switch_context while the thread isn't running
+        uint32_t esp;
+        uint32_t id;
+        State state;
+        const char* name;
+
+        // 0 is the highest
+        uint8_t priority;
+        // The CPU it last ran on, or is queued on
+        uint32_t cpu;
+
+        EntryFunction entry;
+        void* data;
+        // Null for the contexts adopted by initialise and initialiseCPU, which run on their boot stack
+        uint8_t* stack;
+
+        // In the run queue
+        Control* next;
+    };
+
+    struct RunQueue {
+        // Only contended by stealing
+        Spinlock::Ticket lock;
+        // Bit n is set while heads[n] isn't empty
+        uint32_t bitmap;
+        uint32_t count;
+        Control* heads[priority_count];
+        Control* tails[priority_count];
+    };
+
+    /** initialise:
+     * The calling context (kmain) becomes the boot CPU's "main" thread, and the CPU gets an idle thread.
+     * Needs the heap and CPU::initialise.
+     */
+    void initialise ();
+
+    // For the other CPUs: the calling context becomes this CPU's idle thread. Doesn't allocate.
+    [[noreturn]] void initialiseCPU ();
+
+    /** create:
+     * Makes a thread and queues it on this CPU. It starts with interrupts on, and exits when entry returns.
+     *
+     * @param name Must outlive the thread
+     * @param priority Below priority_count, 0 is the highest
+     * @return The thread, or null if there was no memory for it
+     */
+    Control* create (EntryFunction entry, void* data, const char* name, uint8_t priority=default_priority);
+
+    Control* current ();
+
+    // Gives the CPU to the next ready thread of at least the same priority, if there is one. The current
+    // thread stays ready.
+    void yield ();
+
+    [[noreturn]] void exit ();
+
+    // Whether another thread is waiting for this CPU
+    bool hasReady ();
+
+    // Nests
+    void disablePreemption ();
+    void enablePreemption ();
+
+    // Called by this CPU's timer interrupt on every tick
+    void tick ();
+
+    // Called by isr_common_stub after every handler, with interrupts off
+    extern "C" void preempt_if_needed ();
+
+    /** switch_context:
+     * In context_switch.s. Pushes ebx, esi, edi and ebp, saves esp to *save_esp, loads `esp` and pops them
+     * again. Must be called with interrupts off.
+     */
+    extern "C" void switch_context (uint32_t* save_esp, uint32_t esp);
+};
+
+#endif
@@ -0,0 +1,357 @@
+#include "timer.hpp"
+#include "io.hpp"
+#include "general_assembly.hpp"
+#include "clock.hpp"
+#include "irq.hpp"
+#include "thread.hpp"
+#include "cpu.hpp"
+#include "spinlock.hpp"
+
+namespace {
+    const uint32_t level0_bits = 8;
+    const uint32_t level_bits = 6;
+    const uint32_t level0_size = 1 << level0_bits;
+    const uint32_t level_size = 1 << level_bits;
+    const uint32_t level0_mask = level0_size - 1;
+    const uint32_t level_mask = level_size - 1;
+    // Levels above level 0
+    const uint32_t upper_levels = 3;
+    // The furthest ahead the wheel reaches
+    const uint64_t max_delta = (1ULL << (level0_bits + upper_levels * level_bits)) - 1;
+
+    // Threads can run on any CPU but the PIT only interrupts the boot CPU, so the wheel, ticks and the
+    // stats below are all under this lock. Taken by the IRQ 0 handler, so always with interrupts off.
+    Spinlock::Ticket timer_lock;
+
+    Timer::Entry* level0[level0_size];
+    Timer::Entry* levels[upper_levels][level_size];
+
+    uint32_t frequency = 0;
+    // PIT cycles in one tick
+    uint32_t counts_per_tick = 0;
+    uint32_t nanoseconds_per_tick = 0;
+    uint64_t ticks = 0;
+    // The next tick whose level 0 slot hasn't been run
+    uint64_t wheel_time = 1;
+
+    // `ticks` is (Clock::now() - clock_offset) / nanoseconds_per_tick, rather than counted
+    bool tickless = false;
+    uint64_t clock_offset = 0;
+
+    Timer::HandlerStats handler_stats;
+    // Except halts, which every CPU counts in its own CPU::Data
+    Timer::IdleStats idle_stats;
+
+    uint32_t getShift (uint32_t level) {
+        return level0_bits + level * level_bits;
+    }
+
+    void link (Timer::Entry& entry, Timer::Entry** slot) {
+        entry.next = *slot;
+        if (entry.next) {
+            entry.next->link = &entry.next;
+        }
+        entry.link = slot;
+        *slot = &entry;
+    }
+
+    void unlink (Timer::Entry& entry) {
+        *entry.link = entry.next;
+        if (entry.next) {
+            entry.next->link = entry.link;
+        }
+        entry.next = 0;
+        entry.link = 0;
+    }
+
+    // Puts the entry into the slot for its expiry, relative to wheel_time
+    void insert (Timer::Entry& entry) {
+        uint64_t expires = entry.expires;
+        uint64_t delta = expires - wheel_time;
+
+        if ((int64_t)delta < 0) {
+            // Already due, run it with the next tick
+            link(entry, &level0[wheel_time & level0_mask]);
+            return;
+        }
+        if (delta < level0_size) {
+            link(entry, &level0[expires & level0_mask]);
+            return;
+        }
+        if (delta > max_delta) {
+            // Park it as far out as possible, it is placed again from there
+            expires = wheel_time + max_delta;
+            delta = max_delta;
+        }
+        uint32_t level = 0;
+        while (delta >= (1ULL << getShift(level + 1))) {
+            level++;
+        }
+        link(entry, &levels[level][(expires >> getShift(level)) & level_mask]);
+    }
+
+    // Moves the slot's entries down to where they belong now
+    void cascade (Timer::Entry** slot) {
+        Timer::Entry* list = *slot;
+        *slot = 0;
+        while (list) {
+            Timer::Entry* entry = list;
+            list = entry->next;
+            insert(*entry);
+        }
+    }
+
+    void runTick () {
+        uint32_t index = wheel_time & level0_mask;
+        if (index == 0) {
+            // Level 0 has come around, refill it from the level above (which may have come around too)
+            for (uint32_t level = 0; level < upper_levels; level++) {
+                uint32_t level_index = (wheel_time >> getShift(level)) & level_mask;
+                cascade(&levels[level][level_index]);
+                if (level_index != 0) {
+                    break;
+                }
+            }
+        }
+
+        // Take the slot's list out first, so that timers added by the callbacks don't end up in it
+        Timer::Entry* list = level0[index];
+        level0[index] = 0;
+        if (list) {
+            list->link = &list;
+        }
+        wheel_time++;
+
+        while (list) {
+            Timer::Entry* entry = list;
+            unlink(*entry);
+            // Unlocked, so that the callback can add and cancel timers. Cancelling one that is still in
+            // list (from here or another CPU) unlinks it from there, list is read again after this.
+            Spinlock::unlock(timer_lock);
+            entry->callback(entry->data);
+            Spinlock::lock(timer_lock);
+        }
+    }
+
+    // The earliest expiry of a pending timer, or `limit` if there is none before it
+    uint64_t getNextExpiry (uint64_t limit) {
+        uint64_t next = limit;
+
+        // Everything in a level 0 slot expires in the same tick (or is already due)
+        uint32_t current = wheel_time & level0_mask;
+        for (uint32_t i = 0; i < level0_size && wheel_time + i < next; i++) {
+            if (level0[(current + i) & level0_mask]) {
+                next = wheel_time + i;
+                break;
+            }
+        }
+
+        // The slots of the upper levels are in order of expiry too, except that the current slot can hold
+        // either the nearest timers (its cascade is still to come) or the furthest (a whole turn ahead)
+        for (uint32_t level = 0; level < upper_levels; level++) {
+            current = (wheel_time >> getShift(level)) & level_mask;
+            for (uint32_t i = 0; i < level_size; i++) {
+                Timer::Entry* slot = levels[level][(current + i) & level_mask];
+                for (Timer::Entry* entry = slot; entry; entry = entry->next) {
+                    if (entry->expires < next) {
+                        next = entry->expires;
+                    }
+                }
+                if (slot && i != 0) {
+                    break;
+                }
+            }
+        }
+        return next;
+    }
+
+    // Brings `ticks` up to date and runs the timers that have expired. With timer_lock held, which is
+    // dropped while the callbacks run.
+    void advance () {
+        if (tickless) {
+            uint64_t now = divide64(Clock::now() - clock_offset, nanoseconds_per_tick);
+            if (now > ticks) {
+                ticks = now;
+            }
+        } else {
+            ticks++;
+        }
+        while (wheel_time <= ticks) {
+            runTick();
+        }
+    }
+}
+
+void Timer::initialise (uint32_t t_frequency) {
+    frequency = PIT::setPeriodic(t_frequency);
+    counts_per_tick = (PIT::base_frequency + t_frequency / 2) / t_frequency;
+    nanoseconds_per_tick = 1000000000 / frequency;
+    wheel_time = ticks + 1;
+
+    // A TSC that isn't invariant can stop or slow down in the very halt that tickless idle relies on it
+    // through, ticks would then fall behind
+    tickless = Clock::hasInvariantTSC();
+    if (tickless) {
+        clock_offset = Clock::now() - ticks * nanoseconds_per_tick;
+    }
+    Spinlock::addStats(timer_lock.stats, "timer");
+    ISR::setIRQHandler(IRQ::getVector(PIT::irq), Timer::interruptHandler);
+    IRQ::unmask(PIT::irq);
+}
+
+uint32_t Timer::getFrequency () {
+    return frequency;
+}
+
+uint64_t Timer::getTicks () {
+    // A 64-bit read is two loads, the boot CPU mustn't advance it in between
+    uint32_t flags = Spinlock::lockIRQSave(timer_lock);
+    uint64_t value = ticks;
+    Spinlock::unlockIRQRestore(timer_lock, flags);
+    return value;
+}
+
+uint64_t Timer::getMilliseconds () {
+    return divide64(getTicks() * 1000, frequency);
+}
+
+uint64_t Timer::millisecondsToTicks (uint32_t milliseconds) {
+    return divide64((uint64_t)milliseconds * frequency + 999, 1000);
+}
+
+void Timer::initEntry (Timer::Entry& entry, Timer::Callback callback, void* data) {
+    entry.next = 0;
+    entry.link = 0;
+    entry.expires = 0;
+    entry.callback = callback;
+    entry.data = data;
+}
+
+void Timer::add (Timer::Entry& entry, uint64_t expires) {
+    uint32_t flags = Spinlock::lockIRQSave(timer_lock);
+    entry.expires = expires;
+    insert(entry);
+    Spinlock::unlockIRQRestore(timer_lock, flags);
+}
+
+bool Timer::cancel (Timer::Entry& entry) {
+    uint32_t flags = Spinlock::lockIRQSave(timer_lock);
+    bool pending = entry.link != 0;
+    if (pending) {
+        unlink(entry);
+    }
+    Spinlock::unlockIRQRestore(timer_lock, flags);
+    return pending;
+}
+
+bool Timer::isPending (const Timer::Entry& entry) {
+    return __atomic_load_n(&entry.link, __ATOMIC_RELAXED) != 0;
+}
+
+void Timer::sleep (uint64_t count) {
+    uint64_t until = getTicks() + count;
+    while (true) {
+        __asm__ volatile ("cli" : : : "memory");
+        Spinlock::lock(timer_lock);
+        bool done = ticks >= until;
+        Spinlock::unlock(timer_lock);
+        if (done) {
+            break;
+        }
+        if (Thread::hasReady()) {
+            __asm__ volatile ("sti" : : : "memory");
+            Thread::yield();
+        } else {
+            idle();
+        }
+    }
+    __asm__ volatile ("sti" : : : "memory");
+}
+
+void Timer::idle () {
+    CPU::current()->idle_halts++;
+    // The PIT only interrupts the boot CPU, the others can't stop it
+    if (!tickless || CPU::getIndex() != 0) {
+        // sti only takes effect after the next instruction, so an interrupt that is already waiting still
+        // ends the hlt
+        __asm__ volatile ("sti\n\thlt" : : : "memory");
+        return;
+    }
+
+    Spinlock::lock(timer_lock);
+    advance();
+    const uint32_t max_ticks = 0xFFFF / counts_per_tick;
+    uint64_t before = ticks;
+    uint64_t next = getNextExpiry(before + max_ticks);
+    Spinlock::unlock(timer_lock);
+    if (next <= before + 1) {
+        // The next tick comes soon enough
+        __asm__ volatile ("sti\n\thlt" : : : "memory");
+        return;
+    }
+
+    // From now until tick `next` starts
+    uint64_t now = Clock::now();
+    uint64_t wakeup = clock_offset + next * nanoseconds_per_tick;
+    // Rounded up, waking a little late is better than waking up to nothing
+    uint64_t counts = wakeup > now ? divide64((wakeup - now) * PIT::base_frequency, 1000000000) + 1 : 1;
+    if (counts > 0xFFFF) {
+        counts = 0xFFFF;
+    }
+    PIT::setOneShot((uint16_t)counts);
+
+    // Another thread mustn't be switched to with the PIT still in one-shot mode
+    Thread::disablePreemption();
+    __asm__ volatile ("sti\n\thlt\n\tcli" : : : "memory");
+    Thread::enablePreemption();
+
+    PIT::setPeriodic(frequency);
+    Spinlock::lock(timer_lock);
+    advance();
+    idle_stats.tickless_halts++;
+    // One of them was counted by an interrupt
+    if (ticks - before > 1) {
+        idle_stats.skipped_ticks += ticks - before - 1;
+    }
+    Spinlock::unlock(timer_lock);
+    __asm__ volatile ("sti" : : : "memory");
+}
+
+Timer::IdleStats Timer::getIdleStats () {
+    uint32_t flags = Spinlock::lockIRQSave(timer_lock);
+    IdleStats stats = idle_stats;
+    Spinlock::unlockIRQRestore(timer_lock, flags);
+    // Each CPU only adds to its own, a sum that is a little behind is fine
+    stats.halts = 0;
+    for (uint32_t i = 0; i < CPU::max_cpus; i++) {
+        stats.halts += CPU::get(i).idle_halts;
+    }
+    return stats;
+}
+
+Timer::HandlerStats Timer::getHandlerStats () {
+    uint32_t flags = Spinlock::lockIRQSave(timer_lock);
+    HandlerStats stats = handler_stats;
+    Spinlock::unlockIRQRestore(timer_lock, flags);
+    return stats;
+}
+
+void Timer::interruptHandler (ISR::Frame* frame) {
+    uint64_t start = readTimestampCounter();
+
+    IRQ::endOfInterrupt(frame->int_number);
+
+    Spinlock::lock(timer_lock);
+    advance();
+    Spinlock::unlock(timer_lock);
+    Thread::tick();
+
+    uint32_t cycles = (uint32_t)(readTimestampCounter() - start);
+    Spinlock::lock(timer_lock);
+    handler_stats.interrupts++;
+    handler_stats.total_cycles += cycles;
+    if (cycles > handler_stats.max_cycles) {
+        handler_stats.max_cycles = cycles;
+    }
+    Spinlock::unlock(timer_lock);
+}
@@ -0,0 +1,114 @@
+#ifndef INCLUDE_TIMER_H
+#define INCLUDE_TIMER_H
+
+#include "../Include/stdint.h"
+#include "isr.hpp"
+
+/* Timer:
+    The PIT raises IRQ 0 `frequency` times a second, and every interrupt is a tick. `ticks` counts them from
+    initialise on and never wraps (64 bits at 1 kHz last 584 million years).
+
+    Timeouts live in a hierarchical timer wheel, so adding and cancelling are O(1) no matter how many are
+    pending. Level 0 has one slot for each of the next 256 ticks. Each level above has 64 slots that each
+    cover a whole turn of the level below: level 1 slots are 256 ticks wide, level 2 16384, level 3 1048576.
+    A timer goes into the lowest level whose range reaches its expiry. Whenever level 0 comes around to
+    slot 0, the current slot of level 1 is emptied into level 0 (and so on upwards), so timers move down as
+    they come closer and each is moved at most three times. Timers further away than level 3 reaches
+    (about 18 hours at 1 kHz) are parked in its last slot and placed again when they get there.
+
+    Idle:
+    Code with nothing to do calls idle, which halts until the next interrupt. With an invariant TSC (one
+    that keeps counting at the same rate in halts and across frequency changes), it is tickless:
+    instead of waking up for every tick, the PIT is switched to one-shot mode and set to go off when the
+    next timer expires (or after 54 ms, the longest it can count), and goes back to ticking after the
+    wakeup. For this, `ticks` isn't a count of interrupts but Clock::now() in ticks, so it is right after
+    any length of sleep. Otherwise idle halts and the PIT keeps ticking.
+
+    Entries are owned by the caller, the wheel only links them, so nothing is ever allocated.
+    Callbacks run in the IRQ 0 handler on the boot CPU with interrupts disabled, they may add or cancel
+    timers (including their own).
+
+    Every function can be called from any CPU, the wheel and `ticks` are under a spinlock. A timer added
+    from another CPU while the boot CPU is in a tickless halt runs when that halt ends, at most 54 ms late.
+
+    Usage:
+        Timer::initEntry(entry, onTimeout, device);
+        Timer::add(entry, Timer::getTicks() + Timer::millisecondsToTicks(50));
+        ...
+        Timer::cancel(entry);
+*/
+namespace Timer {
+    static const uint32_t default_frequency = 1000;
+
+    using Callback = void (*) (void* data);
+
+    // Plain data so that entries can be statically allocated. Set up with initEntry before use.
+    struct Entry {
+        Entry* next;
+        // The pointer that points to this entry (a slot or the previous entry's next), null when not pending
+        Entry** link;
+        uint64_t expires;
+        Callback callback;
+        void* data;
+    };
+
+    struct HandlerStats {
+        uint64_t interrupts;
+        uint64_t total_cycles;
+        uint32_t max_cycles;
+    };
+
+    struct IdleStats {
+        uint64_t halts;
+        // Halts with the PIT in one-shot mode
+        uint64_t tickless_halts;
+        // Ticks that passed without an interrupt
+        uint64_t skipped_ticks;
+    };
+
+    /** initialise:
+     * Programs the PIT and unmasks IRQ 0. Needs the IDT and the remapped PIC, and Clock for tickless idle.
+     *
+     * @param frequency Ticks per second
+     */
+    void initialise (uint32_t frequency=default_frequency);
+    // The frequency that was really set, which can be slightly off the one asked for
+    uint32_t getFrequency ();
+
+    uint64_t getTicks ();
+    uint64_t getMilliseconds ();
+    // Rounded up, so waiting that many ticks waits at least `milliseconds`
+    uint64_t millisecondsToTicks (uint32_t milliseconds);
+
+    void initEntry (Entry& entry, Callback callback, void* data);
+
+    /** add:
+     * Runs the entry's callback in the tick in which getTicks() reaches `expires`, or the next tick if it
+     * already has. The entry must not already be pending, and must stay alive until it has run or been
+     * cancelled.
+     *
+     * @param expires Absolute, in ticks
+     */
+    void add (Entry& entry, uint64_t expires);
+    // @return Whether it was still pending
+    bool cancel (Entry& entry);
+    bool isPending (const Entry& entry);
+
+    // Halts until `count` ticks have passed. Needs interrupts enabled.
+    void sleep (uint64_t count);
+
+    /** idle:
+     * Halts until an interrupt has been handled. Must be called with interrupts disabled, after checking
+     * that there is nothing to do, and returns with them enabled. That way an interrupt that comes after the
+     * check still ends the halt.
+     */
+    void idle ();
+    IdleStats getIdleStats ();
+
+    // What the IRQ 0 handler costs, from its first to its last instruction (the stubs aren't included)
+    HandlerStats getHandlerStats ();
+
+    void interruptHandler (ISR::Frame* frame);
+};
+
+#endif
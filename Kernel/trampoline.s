@@ -0,0 +1,78 @@
+; Where the other CPUs start (see Kernel/smp.hpp). SMP::initialise copies everything from trampoline_start
+; to trampoline_end to TRAMPOLINE_BASE, fills in the parameters at the end, and sends the startup IPI.
+; A CPU starts here in real mode at TRAMPOLINE_BASE:0, so the code can't use its link addresses and
+; every address goes through AT_BASE.
+
+TRAMPOLINE_BASE equ 0x7000      ; must match SMP::trampoline_address, below 1 MiB and 4 KiB aligned
+CR0_PE       equ 1 << 0
+CR0_PG       equ 1 << 31
+CR4_PSE      equ 1 << 4
+
+%define AT_BASE(label) (TRAMPOLINE_BASE + (label) - trampoline_start)
+
+section .text
+global trampoline_start
+global trampoline_end
+global trampoline_parameters
+
+bits 16
+trampoline_start:
+    cli
+    cld
+    xor ax, ax
+    mov ds, ax
+
+    lgdt [AT_BASE(trampoline_gdt_pointer)]
+    mov eax, cr0
+    or eax, CR0_PE
+    mov cr0, eax
+    jmp dword 0x08:AT_BASE(trampoline_protected)
+
+bits 32
+trampoline_protected:
+    mov ax, 0x10
+    mov ds, ax
+    mov es, ax
+    mov fs, ax
+    mov gs, ax
+    mov ss, ax
+
+    ; The boot CPU's page directory, which identity maps the first 4 MiB while CPUs are being started,
+    ; so this keeps running once paging is on
+    mov eax, cr4
+    or eax, CR4_PSE
+    mov cr4, eax
+    mov eax, [AT_BASE(trampoline_parameters.page_directory)]
+    mov cr3, eax
+    mov eax, cr0
+    or eax, CR0_PG
+    mov cr0, eax
+
+    mov esp, [AT_BASE(trampoline_parameters.stack)]
+    push dword [AT_BASE(trampoline_parameters.cpu_index)]
+    push dword 0                ; no return address, the entry never returns
+    mov eax, [AT_BASE(trampoline_parameters.entry)]
+    jmp eax                     ; absolute, into the higher half
+
+; Flat code and data, the CPU's own GDT is loaded by CPU::initialise
+align 8
+trampoline_gdt:
+    dq 0
+    dq 0x00CF9A000000FFFF
+    dq 0x00CF92000000FFFF
+trampoline_gdt_pointer:
+    dw trampoline_gdt_pointer - trampoline_gdt - 1
+    dd AT_BASE(trampoline_gdt)
+
+; Must match SMP's TrampolineParameters
+align 4
+trampoline_parameters:
+.page_directory:
+    dd 0
+.stack:
+    dd 0
+.entry:
+    dd 0
+.cpu_index:
+    dd 0
+trampoline_end: